@@ -0,0 +1,118 @@
+/* can_autobaud.c
+ * Bitrate detection for the MCP2515 driver in listen-only mode
+ * Steps through candidate bitrates without ever driving the bus, using frames
+ * received vs. MERRF to tell a right guess from a wrong one.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_rebitrate.h"
+#include "can_autobaud.h"
+
+// Tried in this order when no candidate list is given; most common bitrates first
+static const uint8_t can_ab_default[CAN_SPEED_COUNT] = {
+	CAN_SPEED_500K, CAN_SPEED_250K, CAN_SPEED_125K, CAN_SPEED_1M, CAN_SPEED_100K,
+	CAN_SPEED_50K, CAN_SPEED_800K, CAN_SPEED_20K, CAN_SPEED_10K
+};
+
+/* Listen at the current bitrate for up to window ticks.  Returns 1 once CAN_AUTOBAUD_FRAMES frames
+ * arrive without an error, 0 on a receive error (wrong bitrate) or if the window runs out.
+ */
+static uint8_t can_ab_listen(uint32_t window)
+{
+	uint8_t intf, frames = 0;
+	uint32_t start = can_timer_now();
+
+	do {
+		can_r_reg(MCP2515_CANINTF, &intf, 1);
+		if (intf & MCP2515_CANINTF_MERRF)
+			return 0;
+		if (intf & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF)) {
+			// Only the fact that it decoded matters, not what it says
+			can_w_bit(MCP2515_CANINTF, intf & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF), 0);
+			frames += (intf & MCP2515_CANINTF_RX0IF ? 1 : 0) + (intf & MCP2515_CANINTF_RX1IF ? 1 : 0);
+			if (frames >= CAN_AUTOBAUD_FRAMES)
+				return 1;
+		}
+	} while (can_timer_now() - start < window);
+
+	return 0;
+}
+
+/* Find the bus bitrate.  Each CAN_SPEED_* in speeds[] (all of them, most common first, if speeds is 0)
+ * gets up to window_us microseconds in listen-only mode, so the MCP2515 never sends an ACK or error
+ * frame; a wrong bitrate shows up as MERRF, usually within a frame or two.  Both RXBs receive all
+ * frames while this runs and their RX modes are put back afterwards.  Frames seen while searching are
+ * discarded.  Each switch is confirmed through CANSTAT with can_opmode() (can_rebitrate.c), and the
+ * driver lock is held throughout.  can_timer_init() must have been run.
+ *
+ * The controller is left in listen-only mode at the bitrate found (or at the last one tried); use
+ * can_ioctl(MCP2515_OPTION_LISTEN_ONLY, 0) to join the bus.
+ * Returns the CAN_SPEED_* index found, or -1 if no candidate saw enough clean traffic or the controller
+ * didn't change mode in time.
+ */
+int can_autobaud(const uint8_t *speeds, uint8_t n, uint32_t window_us)
+{
+	uint8_t rxctrl[2], i, valid;
+	uint32_t window;
+	int found = -1;
+
+	if (!speeds) {
+		speeds = can_ab_default;
+		n = CAN_SPEED_COUNT;
+	}
+	window = can_timer_ticks(window_us);
+
+	can_lock();
+	can_ioctl(MCP2515_OPTION_LISTEN_ONLY, 1);
+	can_r_reg(MCP2515_RXB0CTRL, &rxctrl[0], 1);
+	can_r_reg(MCP2515_RXB1CTRL, &rxctrl[1], 1);
+	can_rx_mode(0, MCP2515_RXB0CTRL_MODE_RECV_ALL);
+	can_rx_mode(1, MCP2515_RXB1CTRL_MODE_RECV_ALL);
+
+	for (i=0; i < n && found < 0; i++) {
+		/* CNF1-CNF3 only take writes in configuration mode, and can_speed_fast() just requests it.  A
+		 * frame in progress holds the switch off, so wait for CANSTAT to confirm it before writing.
+		 */
+		if (can_opmode(MCP2515_CANCTRL_REQOP_CONFIGURATION) < 0)
+			break;
+		valid = (can_speed_fast(speeds[i]) == 0);
+		if (can_opmode(MCP2515_CANCTRL_REQOP_LISTEN_ONLY) < 0)
+			break;
+		if (!valid)
+			continue;
+		can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_MERRF | MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF, 0);
+		if (can_ab_listen(window))
+			found = speeds[i];
+	}
+
+	can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_MERRF, 0);
+	can_rx_mode(0, rxctrl[0] & (MCP2515_RXB0CTRL_RXM1 | MCP2515_RXB0CTRL_RXM0));
+	can_rx_mode(1, rxctrl[1] & (MCP2515_RXB1CTRL_RXM1 | MCP2515_RXB1CTRL_RXM0));
+	can_unlock();
+
+	return found;
+}
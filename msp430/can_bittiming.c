@@ -0,0 +1,142 @@
+/* can_bittiming.c
+ * CAN bit-timing solver for the MCP2515
+ * Portable C; searches every BRP/TQ/PS2 combination for the oscillator given at runtime, with PROP
+ * held at what the propagation delay needs.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include "can_bittiming.h"
+
+/* MCP2515 bit-timing rules (datasheet section 5):
+ *   TQ = 2 * BRP / Fosc, BRP 1-64; a bit is 5-25 TQ
+ *   PropSeg 1-8, PS1 1-8, PS2 2-8 TQ; PropSeg + PS1 >= PS2; SJW 1-4 and SJW < PS2
+ * Candidates are ranked by, in order: meeting the propagation budget, bitrate error, distance from the
+ * target sample point, widest SJW, and most TQ per bit (finest resync resolution).  Combinations more
+ * than 1% off the bitrate are never considered.
+ */
+
+/* Find the best bit timing for bitrate (Hz) from oscillator fosc (Hz).  sp_target is the wanted sample
+ * point in 1/1000ths of a bit (0 = CAN_BITTIMING_SP_DEFAULT).  prop_ns is the round-trip propagation
+ * delay the propagation segment must cover (bus length both ways plus transceiver loop delay), 0 for none.
+ * Returns 0, or -1 if no combination comes within 1% of bitrate.
+ */
+int can_bittiming_solve(uint32_t fosc, uint32_t bitrate, uint16_t sp_target, uint16_t prop_ns, struct can_bittiming *bt)
+{
+	uint8_t brp, ntq, ps1, ps2, prop, tseg1, sjw, reqprop, viol, found = 0;
+	uint8_t best_viol = 0xFF, best_sjw = 0, best_ntq = 0;
+	uint16_t sp, sperr, best_sperr = 0xFFFF;
+	uint32_t d, diff, ppm, best_ppm = 0xFFFFFFFFUL;
+
+	if (!fosc || !bitrate || bitrate > 1000000UL)
+		return -1;
+	if (!sp_target)
+		sp_target = CAN_BITTIMING_SP_DEFAULT;
+
+	for (brp=1; brp <= 64; brp++) {
+		// TQs the propagation segment needs: prop_ns / (2 * brp / fosc), rounded up
+		reqprop = 1;
+		if (prop_ns) {
+			uint64_t q = ((uint64_t)prop_ns * fosc + 2000000000ULL * brp - 1) / (2000000000ULL * brp);
+			reqprop = (q > 16) ? 16 : (q ? q : 1);
+		}
+
+		for (ntq=25; ntq >= 5; ntq--) {
+			d = 2UL * brp * ntq * bitrate;  // Oscillator frequency that would give bitrate exactly
+			diff = (fosc > d) ? fosc - d : d - fosc;
+			if (diff > d / 100)
+				continue;
+			ppm = (uint32_t)(((uint64_t)diff * 1000000UL + d / 2) / d);
+
+			for (ps2=2; ps2 <= 8; ps2++) {
+				tseg1 = ntq - 1 - ps2;
+				if (tseg1 < 2 || tseg1 > 16 || tseg1 < ps2)
+					continue;
+
+				prop = reqprop;
+				if (prop > 8)
+					prop = 8;
+				if (prop > tseg1 - 1)
+					prop = tseg1 - 1;
+				ps1 = tseg1 - prop;
+				if (ps1 > 8) {
+					prop += ps1 - 8;
+					ps1 = 8;
+				}
+				viol = (prop < reqprop);
+
+				sp = (uint16_t)((1 + tseg1) * 1000UL / ntq);
+				sperr = (sp > sp_target) ? sp - sp_target : sp_target - sp;
+				sjw = 4;
+				if (sjw > ps1)
+					sjw = ps1;
+				if (sjw > ps2 - 1)
+					sjw = ps2 - 1;
+
+				if (found) {
+					if (viol != best_viol) {
+						if (viol > best_viol)
+							continue;
+					} else if (ppm != best_ppm) {
+						if (ppm > best_ppm)
+							continue;
+					} else if (sperr != best_sperr) {
+						if (sperr > best_sperr)
+							continue;
+					} else if (sjw != best_sjw) {
+						if (sjw < best_sjw)
+							continue;
+					} else if (ntq <= best_ntq) {
+						continue;
+					}
+				}
+
+				found = 1;
+				best_viol = viol;
+				best_ppm = ppm;
+				best_sperr = sperr;
+				best_sjw = sjw;
+				best_ntq = ntq;
+
+				bt->brp = brp;
+				bt->prop = prop;
+				bt->ps1 = ps1;
+				bt->ps2 = ps2;
+				bt->sjw = sjw;
+				bt->tq = ntq;
+				bt->sp = sp;
+				bt->bitrate = fosc / (2UL * brp * ntq);
+				bt->error_ppm = (fosc >= d) ? (int32_t)ppm : -(int32_t)ppm;
+				bt->prop_ok = !viol;
+			}
+		}
+	}
+
+	if (!found)
+		return -1;
+
+	bt->cnf[0] = ((bt->sjw - 1) << 6) | (bt->brp - 1);
+	bt->cnf[1] = 0x80 | ((bt->ps1 - 1) << 3) | (bt->prop - 1);  // BTLMODE: PS2 from CNF3
+	bt->cnf[2] = bt->ps2 - 1;
+	return 0;
+}
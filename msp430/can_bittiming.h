@@ -0,0 +1,51 @@
+/* can_bittiming.h
+ * CAN bit-timing solver for the MCP2515
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CAN_BITTIMING_H
+#define CAN_BITTIMING_H
+
+#include <stdint.h>
+
+// Sample point used when none is asked for, in 1/1000ths of a bit (CiA recommendation)
+#define CAN_BITTIMING_SP_DEFAULT 875
+
+/* A solved bit timing.  One bit is 1 (sync) + prop + ps1 + ps2 time quanta of 2*brp oscillator periods. */
+struct can_bittiming {
+	uint8_t brp;          // Baud rate prescaler, 1-64
+	uint8_t prop;         // Propagation segment, 1-8 TQ
+	uint8_t ps1;          // Phase segment 1, 1-8 TQ
+	uint8_t ps2;          // Phase segment 2, 2-8 TQ
+	uint8_t sjw;          // Synchronization jump width, 1-4 TQ
+	uint8_t tq;           // TQ per bit, 5-25
+	uint16_t sp;          // Sample point, 1/1000ths of a bit
+	uint32_t bitrate;     // Bitrate actually produced
+	int32_t error_ppm;    // (bitrate produced - bitrate asked for) in parts per million
+	uint8_t prop_ok;      // 0 if the propagation budget could not be met
+	uint8_t cnf[3];       // CNF1, CNF2, CNF3 register values
+};
+
+/* Function prototypes */
+int can_bittiming_solve(uint32_t, uint32_t, uint16_t, uint16_t, struct can_bittiming *);
+
+#endif
@@ -0,0 +1,141 @@
+/* can_busload.c
+ * Bus-load meter for the MCP2515 driver
+ * Counts the on-wire bits of every frame the driver receives or finishes sending
+ * against the bus capacity over fixed windows.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_framelen.h"
+#include "can_busload.h"
+
+static uint32_t can_bl_window, can_bl_start, can_bl_bits, can_bl_bitrate, can_bl_capacity;
+static uint16_t can_bl_hist[CAN_BUSLOAD_HISTORY];
+static uint8_t can_bl_pos;
+static struct can_busload_stats can_bl_stats;
+
+/* Measure in windows of window_us microseconds.  The bits one window can hold are worked out from
+ * mcp2515_bitrate, and again whenever it changes.  can_timer_init() must have been run.
+ */
+void can_busload_init(uint32_t window_us)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	can_bl_window = can_timer_ticks(window_us);
+	if (!can_bl_window)
+		can_bl_window = 1;
+	can_bl_start = can_timer_now();
+	can_bl_bits = 0;
+	can_bl_bitrate = 0;
+	can_bl_pos = 0;
+	memset(can_bl_hist, 0, sizeof(can_bl_hist));
+	memset(&can_bl_stats, 0, sizeof(can_bl_stats));
+	__set_interrupt_state(sr);
+}
+
+// Close every window that has run out; interrupts are off
+static void can_bl_roll(uint32_t now)
+{
+	uint8_t i;
+	uint16_t load;
+	uint32_t sum;
+
+	while (now - can_bl_start >= can_bl_window) {
+		if (mcp2515_bitrate != can_bl_bitrate) {
+			can_bl_bitrate = mcp2515_bitrate;
+			can_bl_capacity = (uint32_t)((uint64_t)can_bl_bitrate * can_bl_window / CAN_TIMER_HZ);
+		}
+		if (can_bl_capacity)
+			load = (can_bl_bits >= can_bl_capacity) ? 1000 : (uint16_t)((uint64_t)can_bl_bits * 1000 / can_bl_capacity);
+		else
+			load = 0;
+
+		can_bl_hist[can_bl_pos] = load;
+		if (++can_bl_pos >= CAN_BUSLOAD_HISTORY)
+			can_bl_pos = 0;
+		for (i=0, sum=0; i < CAN_BUSLOAD_HISTORY; i++)
+			sum += can_bl_hist[i];
+		can_bl_stats.load = load;
+		can_bl_stats.avg = sum / CAN_BUSLOAD_HISTORY;
+		if (load > can_bl_stats.peak)
+			can_bl_stats.peak = load;
+
+		can_bl_bits = 0;
+		can_bl_start += can_bl_window;
+		// Idle for a long while; everything still in the history is from before the gap
+		if (now - can_bl_start >= CAN_BUSLOAD_HISTORY * can_bl_window) {
+			memset(can_bl_hist, 0, sizeof(can_bl_hist));
+			can_bl_stats.load = can_bl_stats.avg = 0;
+			can_bl_start = now;
+		}
+	}
+}
+
+/* Bits a frame in MCP2515 register layout (SIDH, SIDL, EID8, EID0, DLC) takes on the wire.  data == 0,
+ * e.g. for a frame dropped after its header, gives the worst case for its DLC.
+ */
+uint16_t can_busload_bits(const uint8_t *hdr, const uint8_t *data)
+{
+#if CAN_BUSLOAD_EXACT
+	return can_framelen_raw(hdr, data);
+#else
+	return can_framelen_raw(hdr, 0);
+#endif
+}
+
+// Count one frame of the given length in bits; safe to call from ISRs.
+void can_busload_add(uint16_t bits)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	can_bl_roll(can_timer_now());
+	can_bl_bits += bits;
+	can_bl_stats.frames++;
+	can_bl_stats.bits += bits;
+	__set_interrupt_state(sr);
+}
+
+// Copy out the statistics; reset != 0 restarts the peak and the frame/bit totals.
+void can_busload_getstats(struct can_busload_stats *stats, uint8_t reset)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	can_bl_roll(can_timer_now());
+	memcpy(stats, &can_bl_stats, sizeof(*stats));
+	if (reset) {
+		can_bl_stats.peak = can_bl_stats.load;
+		can_bl_stats.frames = 0;
+		can_bl_stats.bits = 0;
+	}
+	__set_interrupt_state(sr);
+}
@@ -0,0 +1,57 @@
+/* can_busload.h
+ * Bus-load meter for the MCP2515 driver
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CAN_BUSLOAD_H
+#define CAN_BUSLOAD_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_framelen.h"
+
+/* User configuration */
+/* 1 counts each frame's actual stuff bits (a CRC-15 and stuffing pass over ~100 bits per frame);
+ * 0 charges every frame the worst case for its format and DLC, which costs next to nothing.
+ */
+#define CAN_BUSLOAD_EXACT 1
+// Windows averaged for the rolling load
+#define CAN_BUSLOAD_HISTORY 8
+
+/* Loads are in 1/10ths of a percent of the bus capacity at the current bitrate */
+struct can_busload_stats {
+	uint16_t load;    // Last complete window
+	uint16_t avg;     // Mean of the last CAN_BUSLOAD_HISTORY windows
+	uint16_t peak;    // Highest single window since the last reset
+	uint32_t frames;  // Frames counted since the last reset
+	uint32_t bits;    // Bits counted since the last reset
+};
+
+/* Function prototypes */
+void can_busload_init(uint32_t);
+uint16_t can_busload_bits(const uint8_t *, const uint8_t *);
+void can_busload_add(uint16_t);
+void can_busload_getstats(struct can_busload_stats *, uint8_t);
+
+#endif
@@ -0,0 +1,194 @@
+/* can_coalesce.c
+ * Receive interrupt coalescing for the MCP2515 driver
+ * Frames are drained from the MCP2515 in the IRQ pin's ISR and queued in frame pool storage; the
+ * application is only woken once per N frames or once per time window, whichever comes first.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "can_pool.h"
+#include "can_timer.h"
+#include "can_coalesce.h"
+
+// Most can_irq_handler() passes per IRQ pin interrupt before handing over to the application
+#define CAN_COALESCE_MAX_PASSES 8
+
+static struct can_frame *can_cf_q[CAN_POOL_FRAMES];
+static volatile uint8_t can_cf_head, can_cf_count;
+static uint8_t can_cf_nframes, can_cf_open;
+static uint32_t can_cf_window, can_cf_start;
+static struct can_coalesce_stats can_cf_stats;
+
+/* Wake the application after nframes frames or window_us microseconds after the first frame of a
+ * window, whichever comes first.  can_pool_init() and can_timer_init() must have been run.
+ */
+void can_coalesce_init(uint8_t nframes, uint32_t window_us)
+{
+	can_timer_disarm(CAN_COALESCE_TIMER_CH);
+	if (nframes < 1)
+		nframes = 1;
+	if (nframes > CAN_POOL_FRAMES)
+		nframes = CAN_POOL_FRAMES;
+	can_cf_nframes = nframes;
+	can_cf_window = can_timer_ticks(window_us);
+	can_cf_head = can_cf_count = 0;
+	can_cf_open = 0;
+	memset(&can_cf_stats, 0, sizeof(can_cf_stats));
+}
+
+// Close the current window; interrupts are off (ISR or caller)
+static void can_cf_close(uint8_t wakeup)
+{
+	uint32_t hold;
+
+	if (!can_cf_open)
+		return;
+	can_cf_open = 0;
+	can_timer_disarm(CAN_COALESCE_TIMER_CH);
+	if (wakeup) {
+		hold = can_timer_now() - can_cf_start;
+		can_cf_stats.wakeups++;
+		can_cf_stats.total_hold += hold;
+		if (hold > can_cf_stats.max_hold)
+			can_cf_stats.max_hold = hold;
+	}
+}
+
+// Window ran out before enough frames came in
+static uint8_t can_cf_timeout()
+{
+	can_cf_close(1);
+	return 1;
+}
+
+/* Run from the IRQ pin ISR in place of setting MCP2515_IRQ_FLAGGED; wake the CPU on exit if it
+ * returns nonzero.  Anything can_irq_handler() can't deal with by itself (errors needing attention)
+ * wakes the application straight away with MCP2515_IRQ_FLAGGED left set in mcp2515_irq.  If the main
+ * loop is in the driver, the drain runs when it lets go (see can_lock_isr()).
+ */
+uint8_t can_coalesce_irq()
+{
+	struct can_frame *f, scratch;
+	uint8_t pass, wake = 0;
+	uint16_t tail;
+	int irq;
+
+	if (!can_lock_isr(can_coalesce_irq))
+		return 0;
+	mcp2515_irq |= MCP2515_IRQ_FLAGGED;
+	for (pass=0; pass < CAN_COALESCE_MAX_PASSES; pass++) {
+		irq = can_irq_handler();
+		if (!irq)
+			break;  // Nothing left; MCP2515_IRQ_FLAGGED is clear again
+
+		if ( (irq & (MCP2515_IRQ_RX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED)) == MCP2515_IRQ_RX ) {
+			if ( (f = can_pool_alloc()) == 0 ) {
+				can_frame_recv_rxb(mcp2515_buf, &scratch);
+				can_cf_stats.overruns++;
+				wake = 1;
+				continue;
+			}
+			if (can_frame_recv_rxb(mcp2515_buf, f) < 0) {
+				can_pool_free(f);  // Dropped by the accept hook
+				continue;
+			}
+			tail = can_cf_head + can_cf_count;  // No divide in the ISR
+			if (tail >= CAN_POOL_FRAMES)
+				tail -= CAN_POOL_FRAMES;
+			can_cf_q[tail] = f;
+			can_cf_count++;
+			can_cf_stats.frames++;
+			continue;
+		}
+
+		if ( !(irq & MCP2515_IRQ_HANDLED) || (irq & (MCP2515_IRQ_ERROR | MCP2515_IRQ_WAKEUP)) ) {
+			wake = 1;
+			if ( !(irq & MCP2515_IRQ_HANDLED) )
+				break;  // The application's can_irq_handler() loop takes it from here
+		}
+	}
+	if (pass == CAN_COALESCE_MAX_PASSES)
+		wake = 1;
+
+	if (can_cf_count && !can_cf_open) {
+		can_cf_open = 1;
+		can_cf_start = can_timer_now();
+		can_timer_arm(CAN_COALESCE_TIMER_CH, can_cf_start + can_cf_window, can_cf_timeout);
+	}
+	if (can_cf_count >= can_cf_nframes)
+		wake = 1;
+	if (wake)
+		can_cf_close(1);
+	can_unlock();
+	return wake;
+}
+
+/* Copy out the oldest queued frame.  Returns the # of frames still queued after it, or -1 if the
+ * queue was empty.  Emptying the queue ends the current window without another wakeup.
+ */
+int can_coalesce_read(struct can_frame *out)
+{
+	struct can_frame *f;
+	uint16_t sr;
+	int left;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	if (!can_cf_count) {
+		can_cf_close(0);
+		__set_interrupt_state(sr);
+		return -1;
+	}
+	f = can_cf_q[can_cf_head];
+	if (++can_cf_head == CAN_POOL_FRAMES)
+		can_cf_head = 0;
+	left = --can_cf_count;
+	if (!left)
+		can_cf_close(0);
+	__set_interrupt_state(sr);
+
+	memcpy(out, f, sizeof(*out));
+	can_pool_free(f);
+	return left;
+}
+
+uint8_t can_coalesce_pending()
+{
+	return can_cf_count;
+}
+
+// Copy out the statistics; reset != 0 starts them over.
+void can_coalesce_getstats(struct can_coalesce_stats *stats, uint8_t reset)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	memcpy(stats, &can_cf_stats, sizeof(*stats));
+	if (reset)
+		memset(&can_cf_stats, 0, sizeof(can_cf_stats));
+	__set_interrupt_state(sr);
+}
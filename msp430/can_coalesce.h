@@ -0,0 +1,57 @@
+/* can_coalesce.h
+ * Receive interrupt coalescing for the MCP2515 driver
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CAN_COALESCE_H
+#define CAN_COALESCE_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+#include "can_pool.h"
+#include "can_timer.h"
+
+/* User configuration */
+// can_timer compare channel (1 or 2) used for the coalescing window
+#define CAN_COALESCE_TIMER_CH 1
+
+#if CAN_COALESCE_TIMER_CH > CAN_TIMER_CHANNELS
+#error "CAN_COALESCE_TIMER_CH is a compare channel this part's Timer_A0 lacks (no CCR2 on the G2xx1 parts)"
+#endif
+
+/* Coalescing statistics; wakeups vs. frames is the trade being made, hold times are what it costs */
+struct can_coalesce_stats {
+	uint16_t wakeups;     // Times the application was woken for frames
+	uint16_t frames;      // Frames queued
+	uint16_t overruns;    // Frames dropped because the frame pool was empty
+	uint32_t max_hold;    // Longest time (ticks) from the first frame of a window to the wakeup
+	uint32_t total_hold;  // Sum of those times; / wakeups for the average
+};
+
+/* Function prototypes */
+void can_coalesce_init(uint8_t, uint32_t);
+uint8_t can_coalesce_irq();
+int can_coalesce_read(struct can_frame *);
+uint8_t can_coalesce_pending();
+void can_coalesce_getstats(struct can_coalesce_stats *, uint8_t);
+
+#endif
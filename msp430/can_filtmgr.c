@@ -0,0 +1,183 @@
+/* can_filtmgr.c
+ * Adaptive acceptance filter manager for the MCP2515 driver
+ * Counts the unwanted frames the hardware filters let through and periodically re-solves and
+ * reprograms the masks/filters for the traffic actually seen.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "can_swfilter.h"
+#include "can_filtsolve.h"
+#include "can_filtmgr.h"
+
+/* Unwanted IDs are kept in RXB register layout so the accept hook never decodes one:
+ * SIDH, SIDL (ID and IDE bits only), EID8, EID0 (both 0 for Standard frames).
+ */
+struct can_fm_entry {
+	uint8_t key[4];
+	uint16_t count;
+};
+
+static struct can_fm_entry can_fm_track[CAN_FILTMGR_TRACK];
+static uint8_t can_fm_ntrack, can_fm_retunes;
+static uint16_t can_fm_rejected;
+static const struct can_filt_id *can_fm_want;
+static uint16_t can_fm_nwant;
+static struct can_filt_solution can_fm_sol;
+
+/* Subscribe to want[] (which must stay valid), program the best static setup for it and start
+ * counting.  Returns 0, or -1 if the IDs don't fit the software filter or the solver.
+ */
+int can_filtmgr_init(const struct can_filt_id *want, uint16_t nwant)
+{
+	uint16_t i;
+
+	can_rx_accept(0);
+	can_swfilter_init(0);
+	for (i=0; i < nwant; i++) {
+		if (can_swfilter_add(want[i].id, want[i].is_ext) < 0)
+			return -1;
+	}
+
+	can_fm_want = want;
+	can_fm_nwant = nwant;
+	can_fm_ntrack = 0;
+	can_fm_rejected = 0;
+	can_fm_retunes = 0;
+
+	if (can_filt_solve(want, nwant, 0, 0, &can_fm_sol) < 0)
+		return -1;
+	if (can_filt_apply(&can_fm_sol) < 0)
+		return -1;
+	can_rx_accept(can_filtmgr_accept);
+	return 0;
+}
+
+/* The driver's accept hook: the software filter's verdict, counting what it turns down.
+ * Runs wherever the driver reads frames, the IRQ path included.
+ */
+uint8_t can_filtmgr_accept(const uint8_t *hdr)
+{
+	uint8_t key[4], i, min;
+
+	if (can_swfilter_match(hdr))
+		return 1;
+
+	key[0] = hdr[0];
+	if (hdr[1] & 0x08) {
+		key[1] = hdr[1] & 0xEB;
+		key[2] = hdr[2];
+		key[3] = hdr[3];
+	} else {
+		key[1] = hdr[1] & 0xE0;
+		key[2] = key[3] = 0;
+	}
+
+	if (can_fm_rejected != 0xFFFF)
+		can_fm_rejected++;
+	min = 0;
+	for (i=0; i < can_fm_ntrack; i++) {
+		if (!memcmp(can_fm_track[i].key, key, 4)) {
+			if (can_fm_track[i].count != 0xFFFF)
+				can_fm_track[i].count++;
+			return 0;
+		}
+		if (can_fm_track[i].count < can_fm_track[min].count)
+			min = i;
+	}
+
+	if (can_fm_ntrack < CAN_FILTMGR_TRACK) {
+		i = can_fm_ntrack++;
+		can_fm_track[i].count = 1;
+	} else {
+		// Take over the least-seen entry; its count stands in for what this ID may already have had
+		i = min;
+		can_fm_track[i].count++;
+	}
+	memcpy(can_fm_track[i].key, key, 4);
+	return 0;
+}
+
+/* Re-solve the masks/filters against the unwanted traffic counted so far and reprogram the controller
+ * if that cuts what gets through by enough to be worth the configuration-mode blackout.  Counts are
+ * halved afterward so older traffic fades out over a few retunes.  Call it periodically from the main
+ * loop; the solver takes a while and isn't for interrupt context.
+ * Returns 1 if the controller was reprogrammed, 0 if not, -1 on error.
+ */
+int can_filtmgr_retune()
+{
+	struct can_filt_id *others = can_filt_work.others;
+	struct can_filt_solution *sol = &can_filt_work.sol;
+	uint8_t i, j, n;
+	uint16_t sr;
+	uint32_t cur;
+
+	if (!can_fm_want)
+		return -1;
+
+	// Snapshot the table, then age it
+	sr = __get_interrupt_state();
+	_DINT();
+	n = can_fm_ntrack;
+	for (i=0, j=0; i < n; i++) {
+		others[i].id = can_parse_msgid(can_fm_track[i].key);
+		others[i].is_ext = (can_fm_track[i].key[1] & 0x08) ? 1 : 0;
+		others[i].rate = can_fm_track[i].count;
+		if ( (can_fm_track[i].count >>= 1) != 0 )
+			can_fm_track[j++] = can_fm_track[i];
+	}
+	can_fm_ntrack = j;
+	can_fm_rejected = 0;
+	__set_interrupt_state(sr);
+
+	cur = can_filt_rate(&can_fm_sol, others, n);
+	if (!cur)
+		return 0;
+
+	if (can_filt_solve(can_fm_want, can_fm_nwant, others, n, sol) < 0)
+		return -1;
+	if (sol->extra_rate * 100 > cur * CAN_FILTMGR_GAIN_PERCENT)
+		return 0;
+
+	if (can_filt_apply(sol) < 0)
+		return -1;
+	can_fm_sol = *sol;
+	can_fm_retunes++;
+	return 1;
+}
+
+void can_filtmgr_getstats(struct can_filtmgr_stats *stats)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	stats->rejected = can_fm_rejected;
+	stats->tracked = can_fm_ntrack;
+	__set_interrupt_state(sr);
+	stats->retunes = can_fm_retunes;
+	stats->extra_rate = can_fm_sol.extra_rate;
+}
@@ -0,0 +1,63 @@
+/* can_filtmgr.h
+ * Adaptive acceptance filter manager for the MCP2515 driver
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CAN_FILTMGR_H
+#define CAN_FILTMGR_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+#include "can_filtsolve.h"
+
+#ifndef MCP2515_RX_ACCEPT_HOOK
+#error "can_filtmgr needs MCP2515_RX_ACCEPT_HOOK defined in mcp2515.h"
+#endif
+
+/* User configuration */
+/* Unwanted IDs counted between retunes; when the table is full the least-seen entry is replaced.
+ * Retunes hand them to the solver in can_filt_work.others[], so this can't exceed CAN_FILTSOLVE_OTHERS
+ * (which follows the part's RAM).  A retune only reprograms the controller when the new setup lets through at most
+ * CAN_FILTMGR_GAIN_PERCENT of what the current one does, measured on the counted traffic.
+ */
+#define CAN_FILTMGR_TRACK CAN_FILTSOLVE_OTHERS
+#define CAN_FILTMGR_GAIN_PERCENT 75
+
+#if CAN_FILTMGR_TRACK > CAN_FILTSOLVE_OTHERS
+#error "CAN_FILTMGR_TRACK is larger than CAN_FILTSOLVE_OTHERS"
+#endif
+
+/* Manager statistics */
+struct can_filtmgr_stats {
+	uint16_t rejected;      // Frames the hardware accepted and the software filter dropped, since the last retune
+	uint8_t tracked;        // Unwanted IDs in the table
+	uint8_t retunes;        // Times the controller has been reprogrammed
+	uint32_t extra_rate;    // Counted traffic the current setup still lets through
+};
+
+/* Function prototypes */
+int can_filtmgr_init(const struct can_filt_id *, uint16_t);
+int can_filtmgr_retune();
+uint8_t can_filtmgr_accept(const uint8_t *);
+void can_filtmgr_getstats(struct can_filtmgr_stats *);
+
+#endif
@@ -0,0 +1,414 @@
+/* can_filtsolve.c
+ * Acceptance mask/filter solver for the MCP2515
+ * Portable C; the same file builds into firmware and into the host tool under tools/can_filtsolve.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include "can_filtsolve.h"
+#ifdef __MSP430__
+#include <msp430.h>
+#include "mcp2515.h"
+#endif
+
+/* The MCP2515 accepts a frame into an RXB when (id & mask) == (filter & mask) for any of that RXB's
+ * filters.  RXB0 has one mask and 2 filters, RXB1 one mask and 4 filters, and each RXB is either Standard
+ * or Extended (see can_rx_setfilter()).  The solver groups wanted IDs into clusters, one per filter; a
+ * cluster's diff holds the ID bits on which its members disagree, and every such bit has to be a
+ * don't-care in the RXB's mask.
+ *
+ * Cost is measured as the summed rate of unwanted traffic accepted when such a list is supplied, then as
+ * the # of unwanted IDs accepted.  Clustering is greedy (agglomerative): repeatedly merge the pair of
+ * clusters that adds the least cost until they fit the filters available.
+ */
+
+#define CAN_FS_STD_BITS 0x000007FFUL
+#define CAN_FS_EXT_BITS 0x1FFFFFFFUL
+#define CAN_FS_WIDTH(is_ext) ((is_ext) ? CAN_FS_EXT_BITS : CAN_FS_STD_BITS)
+
+struct can_filt_work can_filt_work;
+
+#ifdef __MSP430__
+// Fail to compile (negative array size) if the work area exceeds its share of RAM
+typedef char can_fs_ram_check[(sizeof(can_filt_work) <= (uint32_t)MCP2515_RAM_SIZE * CAN_FILTSOLVE_RAM_PERCENT / 100) ? 1 : -1];
+#endif
+
+static uint8_t can_fs_popcount(uint32_t v)
+{
+	uint8_t n = 0;
+
+	while (v) {
+		v &= v - 1;
+		n++;
+	}
+	return n;
+}
+
+// n << bits, saturating
+static uint32_t can_fs_span(uint32_t n, uint8_t bits)
+{
+	if (!bits)
+		return n;
+	if (bits >= 32 || (n >> (32 - bits)) != 0)
+		return 0xFFFFFFFFUL;
+	return n << bits;
+}
+
+static uint32_t can_fs_sat_add(uint32_t a, uint32_t b)
+{
+	return (a + b < a) ? 0xFFFFFFFFUL : a + b;
+}
+
+// Summed rate of others (of the given format) matching rep outside the don't-care bits dc
+static uint32_t can_fs_rate(uint32_t rep, uint32_t dc, uint8_t is_ext, const struct can_filt_id *others, uint16_t nothers)
+{
+	uint32_t care = ~dc & CAN_FS_WIDTH(is_ext), rate = 0;
+	uint16_t i;
+
+	for (i=0; i < nothers; i++) {
+		if ( !others[i].is_ext == !is_ext && ((others[i].id ^ rep) & care) == 0 )
+			rate += others[i].rate;
+	}
+	return rate;
+}
+
+/* Load the wanted IDs of one format as single-member clusters, dropping duplicates.
+ * Returns the # of clusters, or -1 if there are more than CAN_FILTSOLVE_MAX_IDS.
+ */
+static int can_fs_load(struct can_filt_cluster *cl, const struct can_filt_id *want, uint16_t nwant, uint8_t is_ext)
+{
+	uint16_t i, j, c = 0;
+	uint32_t id;
+
+	for (i=0; i < nwant; i++) {
+		if ( !want[i].is_ext != !is_ext )
+			continue;
+		id = want[i].id & CAN_FS_WIDTH(is_ext);
+		for (j=0; j < c; j++) {
+			if (cl[j].rep == id)
+				break;
+		}
+		if (j < c)
+			continue;
+		if (c >= CAN_FILTSOLVE_MAX_IDS)
+			return -1;
+		cl[c].rep = id;
+		cl[c++].diff = 0;
+	}
+	return c;
+}
+
+static void can_fs_merge_pair(struct can_filt_cluster *cl, uint16_t *c, uint16_t a, uint16_t b)
+{
+	cl[a].diff |= cl[b].diff | (cl[a].rep ^ cl[b].rep);
+	cl[b] = cl[--(*c)];
+}
+
+/* Merge clusters down to k, all sharing one RXB mask.  Cost is the whole RXB's acceptance. */
+static uint16_t can_fs_merge_shared(struct can_filt_cluster *cl, uint16_t c, uint8_t k, uint8_t is_ext,
+                                    const struct can_filt_id *others, uint16_t nothers)
+{
+	uint16_t i, j, n, m, bi = 0, bj = 1;
+	uint32_t dc = 0, ndc, ids, rate, care, best_ids, best_rate;
+
+	for (i=0; i < c; i++)
+		dc |= cl[i].diff;
+
+	while (c > k) {
+		best_ids = best_rate = 0xFFFFFFFFUL;
+		for (i=0; i < c; i++) {
+			for (j=i+1; j < c; j++) {
+				ndc = dc | cl[i].diff | cl[j].diff | (cl[i].rep ^ cl[j].rep);
+				ids = can_fs_span(c - 1, can_fs_popcount(ndc));
+				rate = 0;
+				if (nothers) {
+					// Accepted by any cluster but j, which now lives in i
+					care = ~ndc & CAN_FS_WIDTH(is_ext);
+					for (n=0; n < nothers; n++) {
+						if ( !others[n].is_ext != !is_ext )
+							continue;
+						for (m=0; m < c; m++) {
+							if (m != j && ((others[n].id ^ cl[m].rep) & care) == 0) {
+								rate += others[n].rate;
+								break;
+							}
+						}
+					}
+				}
+				if (rate < best_rate || (rate == best_rate && ids < best_ids)) {
+					best_rate = rate;
+					best_ids = ids;
+					bi = i;
+					bj = j;
+				}
+			}
+		}
+		can_fs_merge_pair(cl, &c, bi, bj);
+		dc |= cl[bi].diff;
+	}
+	return c;
+}
+
+/* Merge clusters down to k, each judged as if it had a mask of its own; used before the clusters
+ * are dealt out between the two RXBs.  Ties go to the merge adding the fewest new don't-care bits
+ * across all clusters, since clusters sharing an RXB end up sharing its mask.
+ */
+static uint16_t can_fs_merge_each(struct can_filt_cluster *cl, uint16_t c, uint8_t k, uint8_t is_ext,
+                                  const struct can_filt_id *others, uint16_t nothers)
+{
+	uint16_t i, j, bi = 0, bj = 1;
+	uint32_t m, alldiff;
+	uint8_t spread, best_spread;
+	int32_t ids, rate, best_ids, best_rate;
+
+	while (c > k) {
+		best_ids = best_rate = 0x7FFFFFFFL;
+		best_spread = 0xFF;
+		alldiff = 0;
+		for (i=0; i < c; i++)
+			alldiff |= cl[i].diff;
+		for (i=0; i < c; i++) {
+			for (j=i+1; j < c; j++) {
+				m = cl[i].diff | cl[j].diff | (cl[i].rep ^ cl[j].rep);
+				ids = (int32_t)can_fs_span(1, can_fs_popcount(m))
+				    - (int32_t)can_fs_span(1, can_fs_popcount(cl[i].diff))
+				    - (int32_t)can_fs_span(1, can_fs_popcount(cl[j].diff));
+				rate = 0;
+				if (nothers)
+					rate = (int32_t)can_fs_rate(cl[i].rep, m, is_ext, others, nothers)
+					     - (int32_t)can_fs_rate(cl[i].rep, cl[i].diff, is_ext, others, nothers)
+					     - (int32_t)can_fs_rate(cl[j].rep, cl[j].diff, is_ext, others, nothers);
+				spread = can_fs_popcount(alldiff | m);
+				if (rate < best_rate || (rate == best_rate && (ids < best_ids ||
+				    (ids == best_ids && spread < best_spread)))) {
+					best_rate = rate;
+					best_ids = ids;
+					best_spread = spread;
+					bi = i;
+					bj = j;
+				}
+			}
+		}
+		can_fs_merge_pair(cl, &c, bi, bj);
+	}
+	return c;
+}
+
+/* Program RXB rxb's mask and filters in sol from c clusters (c <= filters available).  Spare filters
+ * repeat the first one.
+ */
+static void can_fs_fill(struct can_filt_solution *sol, uint8_t rxb, const struct can_filt_cluster *cl, uint16_t c, uint8_t is_ext)
+{
+	uint8_t i, first = rxb ? 2 : 0, nfilt = rxb ? 4 : 2;
+	uint32_t dc = 0;
+
+	for (i=0; i < c; i++)
+		dc |= cl[i].diff;
+	sol->mask[rxb] = ~dc & CAN_FS_WIDTH(is_ext);
+	sol->is_ext[rxb] = is_ext;
+	for (i=0; i < nfilt; i++)
+		sol->filter[first+i] = cl[(i < c) ? i : 0].rep;
+}
+
+// An RXB with nothing of its own to do mirrors one exact wanted ID from the other RXB.
+static void can_fs_fill_idle(struct can_filt_solution *sol, uint8_t rxb)
+{
+	uint8_t i, first = rxb ? 2 : 0, nfilt = rxb ? 4 : 2, other = rxb ? 0 : 1;
+
+	sol->is_ext[rxb] = sol->is_ext[other];
+	sol->mask[rxb] = CAN_FS_WIDTH(sol->is_ext[other]);
+	for (i=0; i < nfilt; i++)
+		sol->filter[first+i] = sol->filter[other ? 2 : 0];
+}
+
+/* Summed rate of the traffic in others[] that a solution (or any mask/filter set written into one)
+ * lets through.
+ */
+uint32_t can_filt_rate(const struct can_filt_solution *sol, const struct can_filt_id *others, uint16_t nothers)
+{
+	uint8_t rxb, i, first, nfilt;
+	uint16_t n;
+	uint32_t mask, rate = 0;
+
+	for (n=0; n < nothers; n++) {
+		for (rxb=0; rxb < 2; rxb++) {
+			if ( !others[n].is_ext != !sol->is_ext[rxb] )
+				continue;
+			first = rxb ? 2 : 0;
+			nfilt = rxb ? 4 : 2;
+			mask = sol->mask[rxb] & CAN_FS_WIDTH(sol->is_ext[rxb]);
+			for (i=0; i < nfilt; i++) {
+				if ( ((others[n].id ^ sol->filter[first+i]) & mask) == 0 )
+					break;
+			}
+			if (i < nfilt)
+				break;
+		}
+		if (rxb < 2)
+			rate += others[n].rate;
+	}
+	return rate;
+}
+
+// Work out extra_ids and extra_rate for a finished solution
+static void can_fs_eval(struct can_filt_solution *sol, const struct can_filt_id *want, uint16_t nwant,
+                        const struct can_filt_id *others, uint16_t nothers)
+{
+	uint8_t rxb, i, j, first, nfilt, distinct;
+	uint16_t n;
+	uint32_t width, mask, span, hit, nw;
+
+	sol->extra_ids = 0;
+	for (rxb=0; rxb < 2; rxb++) {
+		first = rxb ? 2 : 0;
+		nfilt = rxb ? 4 : 2;
+		width = CAN_FS_WIDTH(sol->is_ext[rxb]);
+		mask = sol->mask[rxb] & width;
+
+		distinct = 0;
+		for (i=0; i < nfilt; i++) {
+			for (j=0; j < i; j++) {
+				if ( ((sol->filter[first+i] ^ sol->filter[first+j]) & mask) == 0 )
+					break;
+			}
+			if (j == i)
+				distinct++;
+		}
+		span = can_fs_span(distinct, can_fs_popcount(~mask & width));
+
+		// Less the wanted IDs this RXB accepts (counted once each)
+		hit = nw = 0;
+		for (n=0; n < nwant; n++) {
+			if ( !want[n].is_ext != !sol->is_ext[rxb] )
+				continue;
+			for (j=0; j < n; j++) {
+				if ( !want[j].is_ext == !want[n].is_ext && ((want[j].id ^ want[n].id) & width) == 0 )
+					break;
+			}
+			if (j < n)
+				continue;
+			nw++;
+			for (i=0; i < nfilt; i++) {
+				if ( ((want[n].id ^ sol->filter[first+i]) & mask) == 0 ) {
+					hit++;
+					break;
+				}
+			}
+		}
+		if (span != 0xFFFFFFFFUL)
+			span -= hit;
+		sol->extra_ids = can_fs_sat_add(sol->extra_ids, span);
+	}
+	// Both RXBs the same format may overlap; can't accept more than the whole ID space
+	if (sol->is_ext[0] == sol->is_ext[1] && sol->extra_ids > width - nw + 1)
+		sol->extra_ids = width - nw + 1;
+
+	sol->extra_rate = can_filt_rate(sol, others, nothers);
+}
+
+static uint8_t can_fs_better(const struct can_filt_solution *a, const struct can_filt_solution *b)
+{
+	return a->extra_rate < b->extra_rate || (a->extra_rate == b->extra_rate && a->extra_ids < b->extra_ids);
+}
+
+/* Compute masks and filters for RXB0/RXB1 that accept every ID in want[] and as little else as possible.
+ * others[] (may be 0) lists unwanted traffic known to be on the bus, with rates; when given, the solver
+ * minimizes the accepted rate of it first.  What the hardware still lets through is reported in
+ * sol->extra_ids/extra_rate, i.e. the load left for a software filter.
+ * Returns 0, or -1 if want[] is empty or holds more than CAN_FILTSOLVE_MAX_IDS IDs of one format.
+ */
+int can_filt_solve(const struct can_filt_id *want, uint16_t nwant, const struct can_filt_id *others, uint16_t nothers,
+                   struct can_filt_solution *sol)
+{
+	struct can_filt_cluster *cl = can_filt_work.cl, (*split)[4] = can_filt_work.split;
+	struct can_filt_solution *trial = &can_filt_work.trial;
+	int ns, ne, c;
+	uint8_t orient, fmt, sel, i, n[2];
+
+	ns = can_fs_load(cl, want, nwant, 0);
+	ne = can_fs_load(cl, want, nwant, 1);
+	if (ns < 0 || ne < 0 || (ns == 0 && ne == 0))
+		return -1;
+
+	if (ns && ne) {
+		/* Both formats: one RXB each.  Try Standard in the 2-filter RXB0 and in the 4-filter RXB1. */
+		for (orient=0; orient < 2; orient++) {
+			for (i=0; i < 2; i++) {
+				fmt = orient ^ i;  // RXB i gets format fmt
+				c = can_fs_load(cl, want, nwant, fmt);
+				c = can_fs_merge_shared(cl, c, i ? 4 : 2, fmt, others, nothers);
+				can_fs_fill(trial, i, cl, c, fmt);
+			}
+			can_fs_eval(trial, want, nwant, others, nothers);
+			if (!orient || can_fs_better(trial, sol))
+				*sol = *trial;
+		}
+		return 0;
+	}
+
+	/* One format: cluster down to the 6 filters, then try every way of dealing the clusters
+	 * out to RXB0 (up to 2) and RXB1 (up to 4).
+	 */
+	fmt = ne ? 1 : 0;
+	c = can_fs_load(cl, want, nwant, fmt);
+	c = can_fs_merge_each(cl, c, 6, fmt, others, nothers);
+
+	orient = 0;  // Set once sol holds a candidate
+	for (sel=0; sel < (1 << c); sel++) {
+		n[0] = n[1] = 0;
+		for (i=0; i < c; i++) {
+			if (sel & (1 << i)) {
+				if (n[0] == 2)
+					break;
+				split[0][n[0]++] = cl[i];
+			} else {
+				if (n[1] == 4)
+					break;
+				split[1][n[1]++] = cl[i];
+			}
+		}
+		if (i < c || n[1] == 0)
+			continue;
+		can_fs_fill(trial, 1, split[1], n[1], fmt);
+		if (n[0])
+			can_fs_fill(trial, 0, split[0], n[0], fmt);
+		else
+			can_fs_fill_idle(trial, 0);
+		can_fs_eval(trial, want, nwant, others, nothers);
+		if (!orient || can_fs_better(trial, sol)) {
+			*sol = *trial;
+			orient = 1;
+		}
+	}
+	return 0;
+}
+
+#ifdef __MSP430__
+/* Load a solution into the MCP2515 in one configuration-mode window.  RXB0 rollover and RX modes are
+ * left as they are.  Returns 0, or -1 if configuration mode couldn't be entered.
+ */
+int can_filt_apply(const struct can_filt_solution *sol)
+{
+	return can_rx_setconfig(sol->mask, sol->is_ext, sol->filter);
+}
+#endif
@@ -0,0 +1,107 @@
+/* can_filtsolve.h
+ * Acceptance mask/filter solver for the MCP2515
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CAN_FILTSOLVE_H
+#define CAN_FILTSOLVE_H
+
+#include <stdint.h>
+
+#ifdef __MSP430__
+#include "mcp2515.h"
+#endif
+
+/* User configuration */
+/* Most wanted IDs of one format can_filt_solve() takes (CAN_FILTSOLVE_MAX_IDS), and entries in the
+ * others[] list kept in can_filt_work for callers such as can_filtmgr.c (CAN_FILTSOLVE_OTHERS).  The
+ * solver's work area is the static can_filt_work, 8 bytes per ID of each kind plus about 150 bytes, so
+ * its RAM shows up at link time instead of on the stack.  Defaults follow MCP2515_RAM_SIZE and the build
+ * fails if the work area takes more than CAN_FILTSOLVE_RAM_PERCENT of RAM.  The host tool raises
+ * CAN_FILTSOLVE_MAX_IDS on its command line.
+ */
+#define CAN_FILTSOLVE_RAM_PERCENT 50
+
+#if defined(__MSP430__) && MCP2515_RAM_SIZE < 512
+#error "can_filtsolve doesn't fit this part's RAM; run tools/can_filtsolve on the host and hard-code its output"
+#endif
+#ifndef CAN_FILTSOLVE_MAX_IDS
+#if defined(__MSP430__) && MCP2515_RAM_SIZE < 2048
+#define CAN_FILTSOLVE_MAX_IDS 6
+#else
+#define CAN_FILTSOLVE_MAX_IDS 32
+#endif
+#endif
+#ifndef CAN_FILTSOLVE_OTHERS
+#if defined(__MSP430__) && MCP2515_RAM_SIZE < 2048
+#define CAN_FILTSOLVE_OTHERS 6
+#else
+#define CAN_FILTSOLVE_OTHERS 16
+#endif
+#endif
+
+/* A message ID.  rate (frames/sec, or any consistent unit) is only looked at for the
+ * unwanted-traffic list.
+ */
+struct can_filt_id {
+	uint32_t id;
+	uint8_t is_ext;
+	uint16_t rate;
+};
+
+/* Solver output, laid out the way can_rx_setmask()/can_rx_setfilter() take it */
+struct can_filt_solution {
+	uint32_t mask[2];     // RXM0 (RXB0), RXM1 (RXB1)
+	uint32_t filter[6];   // RXF0-RXF5: RXB0 filters 0-1, then RXB1 filters 0-3
+	uint8_t is_ext[2];    // Format of each RXB's mask and filters
+	uint32_t extra_ids;   // # of unwanted IDs still accepted by the hardware (saturates at 0xFFFFFFFF)
+	uint32_t extra_rate;  // Summed rate of listed unwanted IDs still accepted by the hardware
+};
+
+/* A group of wanted IDs sharing one filter */
+struct can_filt_cluster {
+	uint32_t rep;   // Any member ID
+	uint32_t diff;  // Bits that differ between members
+};
+
+/* The solver's static work area.  others[] and sol are free for the caller to build a can_filt_solve()
+ * call in (as can_filtmgr.c does) and aren't touched by the solver except through its arguments; the
+ * rest is scratch.  Only one can_filt_solve() call may run at a time.
+ */
+struct can_filt_work {
+	struct can_filt_id others[CAN_FILTSOLVE_OTHERS];
+	struct can_filt_solution sol;
+	struct can_filt_cluster cl[CAN_FILTSOLVE_MAX_IDS];
+	struct can_filt_cluster split[2][4];
+	struct can_filt_solution trial;
+};
+
+extern struct can_filt_work can_filt_work;
+
+/* Function prototypes */
+int can_filt_solve(const struct can_filt_id *, uint16_t, const struct can_filt_id *, uint16_t, struct can_filt_solution *);
+uint32_t can_filt_rate(const struct can_filt_solution *, const struct can_filt_id *, uint16_t);
+#ifdef __MSP430__
+int can_filt_apply(const struct can_filt_solution *);
+#endif
+
+#endif
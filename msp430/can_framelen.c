@@ -0,0 +1,151 @@
+/* can_framelen.c
+ * On-wire length of CAN 2.0 frames, with exact or worst-case bit stuffing
+ * Portable C, shared with the host tools.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include "can_framelen.h"
+
+/* The frame is walked bit by bit from SOF, feeding the CRC-15 generator (x^15 + x^14 + x^10 + x^8 +
+ * x^7 + x^4 + x^3 + 1) and the stuffing counter together; the CRC field itself is stuffed too but
+ * doesn't feed the CRC.  After 5 equal bits in a row the transmitter inserts one of the opposite
+ * level, which counts towards the next run.
+ */
+struct can_fl_state {
+	uint16_t crc;
+	uint16_t bits;   // Bits sent so far, stuff bits included
+	uint8_t last;    // Level of the previous bit on the wire
+	uint8_t run;     // How many times in a row it has been sent
+};
+
+static void can_fl_bit(struct can_fl_state *st, uint8_t bit, uint8_t crc)
+{
+	if (crc) {
+		if (bit ^ ((st->crc >> 14) & 1))
+			st->crc = ((st->crc << 1) ^ 0x4599) & 0x7FFF;
+		else
+			st->crc = (st->crc << 1) & 0x7FFF;
+	}
+
+	if (st->run && bit == st->last) {
+		st->run++;
+	} else {
+		st->last = bit;
+		st->run = 1;
+	}
+	st->bits++;
+
+	if (st->run == 5) {
+		st->last = !bit;
+		st->run = 1;
+		st->bits++;
+	}
+}
+
+static void can_fl_field(struct can_fl_state *st, uint32_t val, uint8_t nbits, uint8_t crc)
+{
+	while (nbits--)
+		can_fl_bit(st, (val >> nbits) & 1, crc);
+}
+
+// Everything from SOF through the data field; returns the # of data bytes sent
+static uint8_t can_fl_head(struct can_fl_state *st, uint32_t id, uint8_t is_ext, uint8_t rtr, uint8_t dlc, const uint8_t *data)
+{
+	uint8_t i, len;
+
+	st->crc = 0;
+	st->bits = 0;
+	st->run = 0;
+
+	can_fl_bit(st, 0, 1);                                 // SOF
+	if (is_ext) {
+		can_fl_field(st, (id >> 18) & 0x7FF, 11, 1);  // Base ID
+		can_fl_field(st, 3, 2, 1);                     // SRR, IDE
+		can_fl_field(st, id & 0x3FFFF, 18, 1);         // ID extension
+		can_fl_field(st, rtr ? 4 : 0, 3, 1);           // RTR, r1, r0
+	} else {
+		can_fl_field(st, id & 0x7FF, 11, 1);
+		can_fl_field(st, rtr ? 4 : 0, 3, 1);           // RTR, IDE, r0
+	}
+	dlc &= 0x0F;
+	can_fl_field(st, dlc, 4, 1);
+
+	len = (rtr || !data) ? 0 : (dlc > 8 ? 8 : dlc);
+	for (i=0; i < len; i++)
+		can_fl_field(st, data[i], 8, 1);
+	return len;
+}
+
+/* CRC-15 of a frame as sent on the wire; the arguments are as for can_framelen(). */
+uint16_t can_crc15(uint32_t id, uint8_t is_ext, uint8_t rtr, uint8_t dlc, const uint8_t *data)
+{
+	struct can_fl_state st;
+
+	can_fl_head(&st, id, is_ext, rtr, dlc, data);
+	return st.crc;
+}
+
+/* Exact length of a frame on the wire in bits, from SOF through the intermission, with the stuff bits
+ * this particular ID and payload produce.  dlc is the DLC field (0-15; more than 8 still sends 8 bytes),
+ * and rtr != 0 for a remote frame, which carries no data.  data may be 0 only if no data is sent.
+ */
+uint16_t can_framelen(uint32_t id, uint8_t is_ext, uint8_t rtr, uint8_t dlc, const uint8_t *data)
+{
+	struct can_fl_state st;
+
+	can_fl_head(&st, id, is_ext, rtr, dlc, data);
+	can_fl_field(&st, st.crc, 15, 0);
+	return st.bits + CAN_FRAMELEN_TAIL;
+}
+
+// Longest a frame of this format and DLC can be, whatever its ID and payload
+uint16_t can_framelen_worst(uint8_t is_ext, uint8_t rtr, uint8_t dlc)
+{
+	dlc &= 0x0F;
+	if (rtr)
+		dlc = 0;
+	if (dlc > 8)
+		dlc = 8;
+	return CAN_FRAMELEN_WORST(is_ext, dlc);
+}
+
+/* Length of a frame in MCP2515 register layout: hdr holds SIDH, SIDL, EID8, EID0 and DLC, as read from an
+ * RXB or written to a TXB.  RTR is taken from DLC bit 6 (TX, and RX Extended) or SIDL's SRR (RX Standard).
+ * With data == 0 the worst case for that DLC is returned instead.
+ */
+uint16_t can_framelen_raw(const uint8_t *hdr, const uint8_t *data)
+{
+	uint8_t is_ext, rtr;
+	uint32_t id;
+
+	is_ext = (hdr[1] & 0x08) ? 1 : 0;
+	rtr = ( (hdr[4] & 0x40) || (!is_ext && (hdr[1] & 0x10)) ) ? 1 : 0;
+	if (!data)
+		return can_framelen_worst(is_ext, rtr, hdr[4]);
+
+	id = ((uint32_t)hdr[0] << 3) | (hdr[1] >> 5);
+	if (is_ext)
+		id = (id << 18) | ((uint32_t)(hdr[1] & 0x03) << 16) | ((uint32_t)hdr[2] << 8) | hdr[3];
+	return can_framelen(id, is_ext, rtr, hdr[4], data);
+}
@@ -0,0 +1,51 @@
+/* can_framelen.h
+ * On-wire length of CAN 2.0 frames, with exact or worst-case bit stuffing
+ * Portable C, shared with the host tools.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CAN_FRAMELEN_H
+#define CAN_FRAMELEN_H
+
+#include <stdint.h>
+
+/* Bits that follow the stuffed part of every frame: CRC delimiter, ACK slot and delimiter, 7-bit EOF and
+ * the 3-bit intermission before the next frame may start.
+ */
+#define CAN_FRAMELEN_TAIL 13
+
+/* Worst-case length in bits, per Davis et al.: the g bits from SOF through the CRC (34 + 8*dlc Standard,
+ * 54 + 8*dlc Extended) can take a stuff bit for every 4 after the first, plus CAN_FRAMELEN_TAIL.
+ * dlc is the number of data bytes sent, 0-8 (0 for remote frames).
+ */
+#define CAN_FRAMELEN_G(is_ext, dlc) (((is_ext) ? 54 : 34) + 8 * (dlc))
+#define CAN_FRAMELEN_WORST(is_ext, dlc) \
+	(CAN_FRAMELEN_G(is_ext, dlc) + CAN_FRAMELEN_TAIL + (CAN_FRAMELEN_G(is_ext, dlc) - 1) / 4)
+
+/* Function prototypes */
+uint16_t can_crc15(uint32_t, uint8_t, uint8_t, uint8_t, const uint8_t *);
+uint16_t can_framelen(uint32_t, uint8_t, uint8_t, uint8_t, const uint8_t *);
+uint16_t can_framelen_worst(uint8_t, uint8_t, uint8_t);
+uint16_t can_framelen_raw(const uint8_t *, const uint8_t *);
+
+#endif
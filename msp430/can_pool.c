@@ -0,0 +1,133 @@
+/* can_pool.c
+ * Fixed-size CAN frame pool for the MCP2515 driver
+ * O(1) alloc/free from a free list, safe to use from ISRs.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "can_pool.h"
+
+#define CAN_POOL_NONE 0xFF
+
+static union can_pool_slot can_pool[CAN_POOL_FRAMES];
+static uint8_t can_pool_used[(CAN_POOL_FRAMES + 7) / 8];  // Bitmap of allocated slots
+
+// Fail to compile (negative array size) if the pool is out of range or exceeds its share of RAM
+typedef char can_pool_size_check[(CAN_POOL_FRAMES >= 1 && CAN_POOL_FRAMES <= 254) ? 1 : -1];
+typedef char can_pool_ram_check[(sizeof(can_pool) <= (uint32_t)MCP2515_RAM_SIZE * CAN_POOL_RAM_PERCENT / 100) ? 1 : -1];
+
+static uint8_t can_pool_head, can_pool_inuse, can_pool_hwm;
+static uint16_t can_pool_failures, can_pool_badfree;
+
+void can_pool_init()
+{
+	uint8_t i;
+
+	for (i=0; i < CAN_POOL_FRAMES-1; i++)
+		can_pool[i].next = i+1;
+	can_pool[CAN_POOL_FRAMES-1].next = CAN_POOL_NONE;
+	memset(can_pool_used, 0, sizeof(can_pool_used));
+
+	can_pool_head = 0;
+	can_pool_inuse = 0;
+	can_pool_hwm = 0;
+	can_pool_failures = 0;
+	can_pool_badfree = 0;
+}
+
+// Returns a frame or 0 if the pool is exhausted.
+struct can_frame *can_pool_alloc()
+{
+	uint16_t sr;
+	union can_pool_slot *slot = 0;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	if (can_pool_head != CAN_POOL_NONE) {
+		slot = &can_pool[can_pool_head];
+		can_pool_used[can_pool_head >> 3] |= 1 << (can_pool_head & 7);
+		can_pool_head = slot->next;
+		if (++can_pool_inuse > can_pool_hwm)
+			can_pool_hwm = can_pool_inuse;
+	} else {
+		can_pool_failures++;
+	}
+	__set_interrupt_state(sr);
+
+	return slot ? &slot->frame : 0;
+}
+
+/* Frames not belonging to the pool are ignored, and so are frames already free; putting one on the free
+ * list twice would have it handed out twice.
+ */
+void can_pool_free(struct can_frame *frame)
+{
+	uint16_t sr;
+	uint8_t i, bit;
+	union can_pool_slot *slot = (union can_pool_slot *)frame;
+
+	if (slot < can_pool || slot >= can_pool + CAN_POOL_FRAMES)
+		return;
+	i = slot - can_pool;
+	bit = 1 << (i & 7);
+
+	sr = __get_interrupt_state();
+	_DINT();
+	if (can_pool_used[i >> 3] & bit) {
+		can_pool_used[i >> 3] &= ~bit;
+		slot->next = can_pool_head;
+		can_pool_head = i;
+		can_pool_inuse--;
+	} else {
+		can_pool_badfree++;
+	}
+	__set_interrupt_state(sr);
+}
+
+uint8_t can_pool_available()
+{
+	return CAN_POOL_FRAMES - can_pool_inuse;
+}
+
+// Copy out the pool statistics; reset_hwm != 0 restarts the high-water mark and failure count.
+void can_pool_getstats(struct can_pool_stats *stats, uint8_t reset_hwm)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	stats->size = CAN_POOL_FRAMES;
+	stats->in_use = can_pool_inuse;
+	stats->high_water = can_pool_hwm;
+	stats->failures = can_pool_failures;
+	stats->bad_frees = can_pool_badfree;
+	if (reset_hwm) {
+		can_pool_hwm = can_pool_inuse;
+		can_pool_failures = 0;
+		can_pool_badfree = 0;
+	}
+	__set_interrupt_state(sr);
+}
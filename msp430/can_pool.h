@@ -0,0 +1,67 @@
+/* can_pool.h
+ * Fixed-size CAN frame pool for the MCP2515 driver
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CAN_POOL_H
+#define CAN_POOL_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/* User configuration */
+/* Any frame buffering layered on top of the driver allocates struct can_frame objects from this pool.
+ * CAN_POOL_FRAMES may be set here; otherwise the pool gets as many frames as fit in CAN_POOL_RAM_PERCENT
+ * of the target part's RAM (MCP2515_RAM_SIZE in mcp2515.h; struct can_frame grows with
+ * MCP2515_FRAME_TIMESTAMP).  The pool may not take more than that share or the build fails.
+ */
+//#define CAN_POOL_FRAMES 8
+#define CAN_POOL_RAM_PERCENT 25
+
+/* A free slot stores the index of the next free slot in place of the frame */
+union can_pool_slot {
+	struct can_frame frame;
+	uint8_t next;
+};
+
+#ifndef CAN_POOL_FRAMES
+#define CAN_POOL_FIT ((uint16_t)((uint32_t)MCP2515_RAM_SIZE * CAN_POOL_RAM_PERCENT / 100 / sizeof(union can_pool_slot)))
+#define CAN_POOL_FRAMES (CAN_POOL_FIT > 254 ? 254 : (CAN_POOL_FIT < 1 ? 1 : CAN_POOL_FIT))
+#endif
+
+/* Pool statistics */
+struct can_pool_stats {
+	uint8_t size;        // CAN_POOL_FRAMES
+	uint8_t in_use;      // Frames currently allocated
+	uint8_t high_water;  // Most frames ever allocated at once
+	uint16_t failures;   // can_pool_alloc() calls that found the pool empty
+	uint16_t bad_frees;  // can_pool_free() calls on a frame that was already free (ignored)
+};
+
+/* Function prototypes */
+void can_pool_init();
+struct can_frame *can_pool_alloc();
+void can_pool_free(struct can_frame *);
+uint8_t can_pool_available();
+void can_pool_getstats(struct can_pool_stats *, uint8_t);
+
+#endif
@@ -0,0 +1,102 @@
+/* can_rebitrate.c
+ * Bitrate switching with the shortest possible time off the bus
+ * Configuration mode lasts one burst read and one burst write of CNF3-CNF1,
+ * with the mode switches confirmed through CANSTAT in bounded time.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_rebitrate.h"
+
+/* Request operating mode opmod (MCP2515_CANCTRL_REQOP_*) and poll CANSTAT until OPMOD follows.  The wait
+ * is bounded in time, not polls: CAN_OPMODE_BITS bit times at mcp2515_bitrate (10kbps if none is set yet),
+ * measured with can_timer.  Returns 0, or -1 if the controller didn't get there in time.
+ */
+int can_opmode(uint8_t opmod)
+{
+	uint8_t stat;
+	uint32_t bitrate = mcp2515_bitrate ? mcp2515_bitrate : 10000UL;
+	uint32_t start, limit;
+	int ret = -1;
+
+	// One tick extra, since the first one may be almost over already
+	limit = (uint32_t)(((uint64_t)CAN_OPMODE_BITS * CAN_TIMER_HZ + bitrate - 1) / bitrate) + 1;
+
+	can_lock();
+	can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, opmod);
+	start = can_timer_now();
+	do {
+		can_r_reg(MCP2515_CANSTAT, &stat, 1);
+		if ( (stat & MCP2515_CANSTAT_OPMOD_MASK) == opmod ) {  // REQOP and OPMOD share bit positions
+			ret = 0;
+			break;
+		}
+	} while (can_timer_now() - start <= limit);
+	can_unlock();
+
+	return ret;
+}
+
+/* Switch to new CNF1, CNF2, CNF3 values (cnf[0]-cnf[2]), producing bitrate, and go back to whatever mode
+ * the controller was in.  can_cnf_write() merges CNF3..CNF1 (keeping SOF/WAKFIL/SAM) with one burst read
+ * and one 5-byte WRITE, so configuration mode only covers those and the mode switches.  Masks, filters,
+ * CANINTE and the other options are left alone; configuration mode doesn't touch them.  can_timer_init()
+ * must have been run.
+ *
+ * *offbus (if not 0) receives the time in can_timer ticks from configuration mode being confirmed to the
+ * old mode being confirmed.  The controller still waits for 11 recessive bits after that before it
+ * takes part in traffic again.
+ * Returns 0, or -1 if the controller didn't enter configuration mode (nothing changed then) or didn't
+ * come back out of it.
+ */
+int can_rebitrate(const uint8_t *cnf, uint32_t bitrate, uint32_t *offbus)
+{
+	uint8_t ctrl, opmod;
+	uint32_t t0;
+	int ret = 0;
+
+	can_lock();
+	can_r_reg(MCP2515_CANCTRL, &ctrl, 1);
+	opmod = ctrl & MCP2515_CANCTRL_REQOP_MASK;
+
+	// The switch waits out any frame in progress on the bus
+	if (opmod != MCP2515_CANCTRL_REQOP_CONFIGURATION && can_opmode(MCP2515_CANCTRL_REQOP_CONFIGURATION) < 0) {
+		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, opmod);
+		can_unlock();
+		return -1;
+	}
+	t0 = can_timer_now();
+
+	can_cnf_write(cnf, bitrate);
+
+	if (opmod != MCP2515_CANCTRL_REQOP_CONFIGURATION)
+		ret = can_opmode(opmod);
+
+	if (offbus)
+		*offbus = can_timer_now() - t0;
+	can_unlock();
+	return ret;
+}
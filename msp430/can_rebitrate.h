@@ -0,0 +1,43 @@
+/* can_rebitrate.h
+ * Bitrate switching with the shortest possible time off the bus
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CAN_REBITRATE_H
+#define CAN_REBITRATE_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+
+/* User configuration */
+/* Bit times can_opmode() waits for OPMOD to follow REQOP.  The MCP2515 finishes the frame in progress
+ * first: up to 160 bits for a stuffed 8-byte extended frame, plus an error frame and intermission.
+ */
+#define CAN_OPMODE_BITS 200
+
+/* Function prototypes */
+int can_opmode(uint8_t);
+int can_rebitrate(const uint8_t *, uint32_t, uint32_t *);
+
+#endif
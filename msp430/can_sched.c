@@ -0,0 +1,300 @@
+/* can_sched.c
+ * Time-triggered periodic transmit scheduler
+ * Hashed timer wheel on one can_timer compare channel; frames are released from the timer ISR.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_sched.h"
+
+#if CAN_SCHED_SLOTS & (CAN_SCHED_SLOTS - 1)
+#error "CAN_SCHED_SLOTS must be a power of 2"
+#endif
+#if CAN_TIMER_HZ * CAN_SCHED_TICK_US < 1000000
+#error "CAN_SCHED_TICK_US must be at least one can_timer tick"
+#endif
+
+/* A wheel tick is CAN_SCH_LEN can_timer ticks, and one more whenever the CAN_SCH_REM leftovers (in
+ * millionths of a can_timer tick) add up to a whole one, so wheel ticks average exactly CAN_SCHED_TICK_US.
+ */
+#define CAN_SCH_LEN ((uint32_t)((uint64_t)CAN_TIMER_HZ * CAN_SCHED_TICK_US / 1000000UL))
+#define CAN_SCH_REM ((uint32_t)((uint64_t)CAN_TIMER_HZ * CAN_SCHED_TICK_US % 1000000UL))
+
+// One more state: due on the tick being run and not tried yet.  Only ever seen inside can_sch_run_tick().
+#define CAN_SCH_DUE 3
+
+/* A message due at wheel tick t waits in slot t % CAN_SCHED_SLOTS.  Each tick walks only its own slot and
+ * releases the entries due on exactly that tick, skipping any due a lap or more later.  Since periods are
+ * below 32768 ticks, the low 16 bits of a due tick are enough to tell the laps apart.
+ */
+static struct can_sched_msg *can_sch_wheel[CAN_SCHED_SLOTS];
+static struct can_sched_msg *can_sch_wait;  // Due but waiting for a TX buffer, most urgent first
+static uint32_t can_sch_tick;   // Next wheel tick to run
+static uint32_t can_sch_at;     // can_timer time it is due
+static uint32_t can_sch_start;  // can_timer time the last tick run was due
+static uint32_t can_sch_acc;    // CAN_SCH_REM leftovers so far
+static struct can_sched_stats can_sch_stats;
+
+// Put m in the slot for its due tick; interrupts are off
+static void can_sch_insert(struct can_sched_msg *m)
+{
+	struct can_sched_msg **slot = &can_sch_wheel[m->due & (CAN_SCHED_SLOTS - 1)];
+
+	m->next = *slot;
+	*slot = m;
+	m->state = CAN_SCHED_WHEEL;
+}
+
+// Take m off the wheel or the waiting list; interrupts are off
+static void can_sch_unlink(struct can_sched_msg *m)
+{
+	struct can_sched_msg **pp = 0;
+
+	if (m->state == CAN_SCHED_WHEEL)
+		pp = &can_sch_wheel[m->due & (CAN_SCHED_SLOTS - 1)];
+	else if (m->state == CAN_SCHED_DEFERRED)
+		pp = &can_sch_wait;
+	for (; pp && *pp; pp = &(*pp)->next) {
+		if (*pp == m) {
+			*pp = m->next;
+			break;
+		}
+	}
+	m->state = CAN_SCHED_IDLE;
+}
+
+/* Where f's ID would come in arbitration, lower first.  Standard IDs line up with the top 11 bits of
+ * extended ones and win a tie with them.
+ */
+static uint32_t can_sch_arb(const struct can_frame *f)
+{
+	if (f->flags & CAN_FRAME_EXT)
+		return (f->id << 1) | 1;
+	return f->id << 19;
+}
+
+/* Add m to the releases waiting for a TX buffer: higher frame.prio first, then the ID that would win
+ * arbitration, then the one that has waited longest.  Interrupts are off.
+ */
+static void can_sch_enqueue(struct can_sched_msg *m)
+{
+	struct can_sched_msg **pp;
+	uint32_t arb = can_sch_arb(&m->frame);
+
+	for (pp = &can_sch_wait; *pp; pp = &(*pp)->next) {
+		if (m->frame.prio > (*pp)->frame.prio)
+			break;
+		if (m->frame.prio == (*pp)->frame.prio && arb < can_sch_arb(&(*pp)->frame))
+			break;
+	}
+	m->next = *pp;
+	*pp = m;
+}
+
+// Put m, released during wheel tick tick, back on the wheel.  Interrupts are off.
+static void can_sch_next(struct can_sched_msg *m, uint32_t tick)
+{
+	// Stay on the original phase; periods that went by while the release waited are dropped
+	m->due += m->period;
+	while ( (int16_t)(m->due - (uint16_t)tick) <= 0 ) {
+		m->due += m->period;
+		can_sch_stats.skipped++;
+	}
+	can_sch_insert(m);
+}
+
+/* Send waiting releases, most urgent first, until none are left or no TX buffer is free.  tick is the
+ * wheel tick being run, or the last one run.  Interrupts are off.
+ */
+static void can_sch_drain(uint32_t tick)
+{
+	struct can_sched_msg *m;
+	uint32_t late;
+
+	while ( (m = can_sch_wait) != 0 ) {
+		if (can_frame_send(&m->frame) < 0)
+			break;
+		can_sch_wait = m->next;
+
+		can_sch_stats.sent++;
+		late = (uint32_t)(uint16_t)((uint16_t)tick - m->due) * CAN_SCH_LEN + (can_timer_now() - can_sch_start);
+		if (late > can_sch_stats.max_late)
+			can_sch_stats.max_late = (late > 0xFFFF) ? 0xFFFF : late;
+		can_sch_next(m, tick);
+	}
+
+	// Whatever is left now waits for can_sch_txfree()
+	for (; m; m = m->next) {
+		if (m->state == CAN_SCH_DUE) {
+			m->state = CAN_SCHED_DEFERRED;
+			can_sch_stats.deferred++;
+		}
+	}
+}
+
+// Run one wheel tick; interrupts are off and can_sch_start is when it was due
+static void can_sch_run_tick(uint32_t tick)
+{
+	struct can_sched_msg **pp, *m, *fire = 0;
+
+	// Unhook everything due now before handling any of it, as a skipped release may land back in this slot
+	pp = &can_sch_wheel[tick & (CAN_SCHED_SLOTS - 1)];
+	while ( (m = *pp) != 0 ) {
+		if (m->due == (uint16_t)tick) {
+			*pp = m->next;
+			m->next = fire;
+			fire = m;
+		} else {
+			pp = &m->next;
+		}
+	}
+
+	// Fill in the payloads, then line them up with the releases still waiting, by urgency
+	while ( (m = fire) != 0 ) {
+		fire = m->next;
+		// A fill() that leaves the frame unsendable skips the period rather than block everything behind it
+		if ( (m->fill && !m->fill(m)) || m->frame.dlc > 8 || m->frame.prio > 3 ) {
+			can_sch_next(m, tick);
+			continue;
+		}
+		m->state = CAN_SCH_DUE;
+		can_sch_enqueue(m);
+	}
+	can_sch_drain(tick);
+}
+
+static uint8_t can_sch_timeout();
+
+// Run every wheel tick that has come due and arm the timer for the next; interrupts are off
+static void can_sch_run()
+{
+	uint32_t tick;
+
+	while ( (int32_t)(can_timer_now() - can_sch_at) >= 0 ) {
+		tick = can_sch_tick++;
+		can_sch_start = can_sch_at;
+		can_sch_at += CAN_SCH_LEN;
+		can_sch_acc += CAN_SCH_REM;
+		if (can_sch_acc >= 1000000UL) {
+			can_sch_acc -= 1000000UL;
+			can_sch_at++;
+		}
+		can_sch_run_tick(tick);
+	}
+	can_timer_arm(CAN_SCHED_TIMER_CH, can_sch_at, can_sch_timeout);
+}
+
+static uint8_t can_sch_timeout()
+{
+	// If the main loop is in the driver, its can_unlock() runs this, and any ticks missed, when it's done
+	if (!can_lock_isr(can_sch_timeout))
+		return 0;
+	can_sch_run();
+	can_unlock();
+	return 0;
+}
+
+// A TX buffer has freed up: give it to the most urgent waiting release now rather than on the next tick
+static void can_sch_txfree(uint8_t txb)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	if (can_sch_wait)
+		can_sch_drain(can_sch_tick - 1);
+	__set_interrupt_state(sr);
+}
+
+/* Start the wheel at tick 0, one tick from now, with nothing scheduled.  can_init() and can_timer_init()
+ * must have been run.  Messages scheduled before are forgotten.
+ */
+void can_sched_init()
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	can_timer_disarm(CAN_SCHED_TIMER_CH);
+	memset(can_sch_wheel, 0, sizeof(can_sch_wheel));
+	can_sch_wait = 0;
+	can_sch_tick = 0;
+	can_sch_acc = 0;
+	memset(&can_sch_stats, 0, sizeof(can_sch_stats));
+	can_sch_start = can_timer_now();
+	can_sch_at = can_sch_start + CAN_SCH_LEN;
+	can_tx_free_hook(can_sch_txfree);
+	can_timer_arm(CAN_SCHED_TIMER_CH, can_sch_at, can_sch_timeout);
+	__set_interrupt_state(sr);
+}
+
+/* Schedule m every m->period wheel ticks, on the ticks (counted from can_sched_init()) where
+ * tick % period == phase % period, so messages keep their relative phases whenever they are added.
+ * Adding a message which is already scheduled moves it.  Returns 0, or -1 if the period or frame is invalid.
+ */
+int can_sched_add(struct can_sched_msg *m, uint16_t phase)
+{
+	uint16_t sr, p = m->period;
+	uint32_t w;
+
+	if (!p || p > 0x7FFF || m->frame.dlc > 8 || m->frame.prio > 3)
+		return -1;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	if (m->state != CAN_SCHED_IDLE)
+		can_sch_unlink(m);
+	w = can_sch_tick;
+	m->due = w + (phase % p + p - w % p) % p;
+	can_sch_insert(m);
+	__set_interrupt_state(sr);
+	return 0;
+}
+
+// Stop releasing m.  A frame of its already loaded into a TX buffer still goes out.
+void can_sched_remove(struct can_sched_msg *m)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	can_sch_unlink(m);
+	__set_interrupt_state(sr);
+}
+
+// Copy out the statistics; reset != 0 starts them over.
+void can_sched_getstats(struct can_sched_stats *stats, uint8_t reset)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	memcpy(stats, &can_sch_stats, sizeof(*stats));
+	if (reset)
+		memset(&can_sch_stats, 0, sizeof(can_sch_stats));
+	__set_interrupt_state(sr);
+}
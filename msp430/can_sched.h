@@ -0,0 +1,85 @@
+/* can_sched.h
+ * Time-triggered periodic transmit scheduler
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CAN_SCHED_H
+#define CAN_SCHED_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+
+#ifndef MCP2515_TX_FREE_HOOK
+#error "can_sched needs MCP2515_TX_FREE_HOOK defined in mcp2515.h"
+#endif
+
+/* User configuration */
+// can_timer compare channel (1 or 2) driving the wheel; can_coalesce uses channel 1
+#define CAN_SCHED_TIMER_CH 2
+
+#if CAN_SCHED_TIMER_CH > CAN_TIMER_CHANNELS
+#error "CAN_SCHED_TIMER_CH is a compare channel this part's Timer_A0 lacks (no CCR2 on the G2xx1 parts)"
+#endif
+// Wheel tick in microseconds.  Ticks alternate between whole can_timer tick counts to average exactly this
+// (at 32768Hz, 1000us is 32 or 33 ticks, 32.768 on average).
+#define CAN_SCHED_TICK_US 1000UL
+// Wheel slots, a power of 2.  Messages whose periods share few factors with it spread out evenly.
+#define CAN_SCHED_SLOTS 32
+
+struct can_sched_msg;
+
+/* Payload source, run from the timer ISR when the message comes due, before its frame is queued for a TX
+ * buffer.  It may rewrite msg->frame.  Return 0 to skip this period's release.
+ */
+typedef uint8_t (*can_sched_fill_t)(struct can_sched_msg *);
+
+/* A periodic message.  The application owns the storage, which has to stay valid while it is scheduled. */
+struct can_sched_msg {
+	struct can_frame frame;       // Sent each period, after fill() if there is one
+	uint16_t period;              // Wheel ticks between releases, 1-32767
+	can_sched_fill_t fill;        // 0 sends frame unchanged
+	/* Owned by the scheduler */
+	struct can_sched_msg *next;
+	uint16_t due;                 // Low 16 bits of the wheel tick of the next release
+	uint8_t state;
+};
+
+/* can_sched_msg state values */
+#define CAN_SCHED_IDLE 0
+#define CAN_SCHED_WHEEL 1     // Waiting in its wheel slot
+#define CAN_SCHED_DEFERRED 2  // Due, waiting for a TX buffer behind more urgent releases
+
+struct can_sched_stats {
+	uint32_t sent;       // Frames released
+	uint16_t deferred;   // Releases which had to wait for a TX buffer
+	uint16_t skipped;    // Periods dropped because a release was still waiting when the next one came due
+	uint16_t max_late;   // Longest time from a message's due tick to its release, in can_timer ticks
+};
+
+/* Function prototypes */
+void can_sched_init();
+int can_sched_add(struct can_sched_msg *, uint16_t);
+void can_sched_remove(struct can_sched_msg *);
+void can_sched_getstats(struct can_sched_stats *, uint8_t);
+
+#endif
@@ -0,0 +1,221 @@
+/* can_swfilter.c
+ * Second-stage software acceptance filter for the MCP2515 driver
+ * Registered with can_rx_accept(), it decides from the raw RXB header bytes, so no message ID is decoded.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "can_swfilter.h"
+
+#define CAN_SWF_MASK (CAN_SWFILTER_EXT_SLOTS-1)
+
+/* Keys are stored in RXB register layout: SIDH, SIDL (IDE set, SRR and unimplemented bit cleared),
+ * EID8, EID0.  A slot whose IDE bit is clear is empty.
+ */
+#define CAN_SWF_SIDL_MASK 0xEB
+#define CAN_SWF_EMPTY(k) (!((k)[1] & 0x08))
+
+#if CAN_SWFILTER_STD
+static uint8_t can_swf_std[256];  // Indexed by SIDH (ID bits 10-3), bit# SIDL[7:5] (ID bits 2-0)
+static const uint8_t can_swf_bit[8] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
+#endif
+static uint8_t can_swf_ext[CAN_SWFILTER_EXT_SLOTS][4];
+static uint8_t can_swf_count, can_swf_pass;
+
+// Byte-wide hash of a register-layout Extended ID; no multiplies or 32-bit math.
+static uint8_t can_swf_hash(const uint8_t *k)
+{
+	uint8_t h;
+
+	h = k[3] ^ ((k[2] << 3) | (k[2] >> 5)) ^ ((k[0] << 5) | (k[0] >> 3)) ^ (k[1] & 0xE3);
+	h ^= h >> 4;
+	return h & CAN_SWF_MASK;
+}
+
+static uint8_t can_swf_same(const uint8_t *k, const uint8_t *hdr)
+{
+	return k[0] == hdr[0] && k[3] == hdr[3] && k[2] == hdr[2] && k[1] == (hdr[1] & CAN_SWF_SIDL_MASK);
+}
+
+// Returns the slot holding key or -1
+static int can_swf_find(const uint8_t *key)
+{
+	uint8_t i, n;
+
+	i = can_swf_hash(key);
+	for (n=0; n < CAN_SWFILTER_EXT_SLOTS; n++) {
+		if (CAN_SWF_EMPTY(can_swf_ext[i]))
+			return -1;
+		if (can_swf_same(can_swf_ext[i], key))
+			return i;
+		i = (i+1) & CAN_SWF_MASK;
+	}
+	return -1;
+}
+
+/* Clear all subscriptions.  pass is a bitmask of CAN_SWFILTER_PASS_STD/CAN_SWFILTER_PASS_EXT for frame
+ * formats which should not be filtered at all.
+ */
+void can_swfilter_init(uint8_t pass)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+#if CAN_SWFILTER_STD
+	memset(can_swf_std, 0, sizeof(can_swf_std));
+#else
+	pass |= CAN_SWFILTER_PASS_STD;
+#endif
+	memset(can_swf_ext, 0, sizeof(can_swf_ext));
+	can_swf_count = 0;
+	can_swf_pass = pass;
+	__set_interrupt_state(sr);
+}
+
+// Subscribe to id.  Returns 0, or -1 if the Extended ID hash set is full.
+int can_swfilter_add(uint32_t id, uint8_t is_ext)
+{
+	uint8_t key[4], i;
+	uint16_t sr;
+	int ret = 0;
+
+	if (!is_ext) {
+#if CAN_SWFILTER_STD
+		id &= 0x7FF;
+		sr = __get_interrupt_state();
+		_DINT();
+		can_swf_std[id >> 3] |= can_swf_bit[id & 0x07];
+		__set_interrupt_state(sr);
+#endif
+		return 0;
+	}
+
+	can_compose_msgid_ext(id, key);
+	key[1] &= CAN_SWF_SIDL_MASK;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	if (can_swf_find(key) < 0) {
+		if (can_swf_count < CAN_SWFILTER_EXT_SLOTS) {
+			i = can_swf_hash(key);
+			while (!CAN_SWF_EMPTY(can_swf_ext[i]))
+				i = (i+1) & CAN_SWF_MASK;
+			memcpy(can_swf_ext[i], key, 4);
+			can_swf_count++;
+		} else {
+			ret = -1;
+		}
+	}
+	__set_interrupt_state(sr);
+	return ret;
+}
+
+/* Unsubscribe from id.  Returns 0, or -1 if it wasn't subscribed.  Extended entries after the hole are
+ * shifted back into it (linear probing deletion) so no tombstones pile up.
+ */
+int can_swfilter_del(uint32_t id, uint8_t is_ext)
+{
+	uint8_t key[4], i, j, home;
+	uint16_t sr;
+	int slot, ret = 0;
+
+	if (!is_ext) {
+#if CAN_SWFILTER_STD
+		id &= 0x7FF;
+		sr = __get_interrupt_state();
+		_DINT();
+		if ( !(can_swf_std[id >> 3] & can_swf_bit[id & 0x07]) )
+			ret = -1;
+		can_swf_std[id >> 3] &= ~can_swf_bit[id & 0x07];
+		__set_interrupt_state(sr);
+#endif
+		return ret;
+	}
+
+	can_compose_msgid_ext(id, key);
+	key[1] &= CAN_SWF_SIDL_MASK;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	slot = can_swf_find(key);
+	if (slot < 0) {
+		ret = -1;
+	} else {
+		i = j = slot;
+		for (;;) {
+			j = (j+1) & CAN_SWF_MASK;
+			if (CAN_SWF_EMPTY(can_swf_ext[j]))
+				break;
+			home = can_swf_hash(can_swf_ext[j]);
+			// Entry j stays put if its home slot lies cyclically within (i, j]
+			if ( (i <= j) ? (i < home && home <= j) : (i < home || home <= j) )
+				continue;
+			memcpy(can_swf_ext[i], can_swf_ext[j], 4);
+			i = j;
+		}
+		can_swf_ext[i][1] = 0;
+		can_swf_count--;
+	}
+	__set_interrupt_state(sr);
+	return ret;
+}
+
+/* The acceptance test: hdr is SIDH, SIDL, EID8, EID0 as read from the RXB.  Returns nonzero to accept.
+ * Standard IDs cost one table lookup; Extended IDs one hash plus a short probe.
+ */
+uint8_t can_swfilter_match(const uint8_t *hdr)
+{
+	uint8_t i, n;
+
+	if ( !(hdr[1] & 0x08) ) {
+#if CAN_SWFILTER_STD
+		if (can_swf_pass & CAN_SWFILTER_PASS_STD)
+			return 1;
+		return can_swf_std[hdr[0]] & can_swf_bit[hdr[1] >> 5];
+#else
+		return 1;
+#endif
+	}
+
+	if (can_swf_pass & CAN_SWFILTER_PASS_EXT)
+		return 1;
+	i = can_swf_hash(hdr);
+	for (n=0; n < CAN_SWFILTER_EXT_SLOTS; n++) {
+		if (CAN_SWF_EMPTY(can_swf_ext[i]))
+			return 0;
+		if (can_swf_same(can_swf_ext[i], hdr))
+			return 1;
+		i = (i+1) & CAN_SWF_MASK;
+	}
+	return 0;
+}
+
+// # of Extended IDs subscribed
+uint8_t can_swfilter_ext_count()
+{
+	return can_swf_count;
+}
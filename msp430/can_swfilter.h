@@ -0,0 +1,55 @@
+/* can_swfilter.h
+ * Second-stage software acceptance filter for the MCP2515 driver
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CAN_SWFILTER_H
+#define CAN_SWFILTER_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/* User configuration */
+/* Standard IDs are kept in a 256-byte bitmap covering all 2048 of them; set CAN_SWFILTER_STD to 0 on
+ * small parts to leave it out, and Standard frames then always pass.  Extended IDs go in an open-addressing
+ * hash set of CAN_SWFILTER_EXT_SLOTS entries (a power of 2, 4 bytes each); keep it under 3/4 full for
+ * short probe runs.
+ */
+#define CAN_SWFILTER_STD 1
+#define CAN_SWFILTER_EXT_SLOTS 32
+
+#if CAN_SWFILTER_EXT_SLOTS < 2 || CAN_SWFILTER_EXT_SLOTS > 128 || (CAN_SWFILTER_EXT_SLOTS & (CAN_SWFILTER_EXT_SLOTS-1))
+#error "CAN_SWFILTER_EXT_SLOTS must be a power of 2 from 2-128"
+#endif
+
+/* can_swfilter_init() options */
+#define CAN_SWFILTER_PASS_STD 0x01  // Let every Standard frame through
+#define CAN_SWFILTER_PASS_EXT 0x02  // Let every Extended frame through
+
+/* Function prototypes */
+void can_swfilter_init(uint8_t);
+int can_swfilter_add(uint32_t, uint8_t);
+int can_swfilter_del(uint32_t, uint8_t);
+uint8_t can_swfilter_match(const uint8_t *);
+uint8_t can_swfilter_ext_count();
+
+#endif
@@ -0,0 +1,170 @@
+/* can_timer.c
+ * Timer_A timebase for the MCP2515 driver's timing features
+ * A free-running 32-bit tick count (Timer_A0 plus an overflow count) and two one-shot compare
+ * channels on CCR1/CCR2.  CCR0 and its vector are left to the application.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include "can_timer.h"
+
+static volatile uint16_t can_tmr_ovf;
+static uint32_t can_tmr_deadline[CAN_TIMER_CHANNELS];
+static can_timer_cb_t can_tmr_cb[CAN_TIMER_CHANNELS];
+
+/* TAR is clocked asynchronously to MCLK when run from ACLK; read it until two reads agree. */
+static uint16_t can_tmr_tar()
+{
+	uint16_t a, b;
+
+	b = TA0R;
+	do {
+		a = b;
+		b = TA0R;
+	} while (a != b);
+	return a;
+}
+
+#if CAN_TIMER_CHANNELS > 1
+static volatile unsigned int *can_tmr_cctl(uint8_t ch)
+{
+	return (ch == 1) ? &TA0CCTL1 : &TA0CCTL2;
+}
+
+static volatile unsigned int *can_tmr_ccr(uint8_t ch)
+{
+	return (ch == 1) ? &TA0CCR1 : &TA0CCR2;
+}
+#else
+#define can_tmr_cctl(ch) (&TA0CCTL1)
+#define can_tmr_ccr(ch) (&TA0CCR1)
+#endif
+
+/* Start Timer_A0 in continuous mode from 0.  The application's TIMER0_A1 ISR must run can_timer_irq(). */
+void can_timer_init()
+{
+	TA0CTL = MC_0 | TACLR;
+	TA0CCTL1 = 0;
+	can_tmr_cb[0] = 0;
+#if CAN_TIMER_CHANNELS > 1
+	TA0CCTL2 = 0;
+	can_tmr_cb[1] = 0;
+#endif
+	can_tmr_ovf = 0;
+	TA0CTL = CAN_TIMER_TASSEL | CAN_TIMER_ID | MC_2 | TAIE;
+}
+
+// Current time in ticks; wraps after 2^32 ticks (~36 hours at 32768Hz).
+uint32_t can_timer_now()
+{
+	uint16_t sr, hi, lo;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	hi = can_tmr_ovf;
+	lo = can_tmr_tar();
+	if ((TA0CTL & TAIFG) && lo < 0x8000)
+		hi++;  // Rolled over, but the overflow interrupt hasn't run yet
+	__set_interrupt_state(sr);
+
+	return ((uint32_t)hi << 16) | lo;
+}
+
+// Microseconds to ticks, rounded up.  Uses 64-bit math; not for time-critical code.
+uint32_t can_timer_ticks(uint32_t us)
+{
+	return CAN_TIMER_US(us);
+}
+
+/* Arm compare channel ch (1 or 2) to run cb at tick at.  A deadline already passed fires right away.
+ * Returns 0, or -1 if ch is invalid or the part lacks it (CAN_TIMER_CHANNELS).
+ */
+int can_timer_arm(uint8_t ch, uint32_t at, can_timer_cb_t cb)
+{
+	volatile unsigned int *cctl;
+	uint16_t sr;
+
+	if (ch < 1 || ch > CAN_TIMER_CHANNELS)
+		return -1;
+	cctl = can_tmr_cctl(ch);
+
+	sr = __get_interrupt_state();
+	_DINT();
+	can_tmr_deadline[ch-1] = at;
+	can_tmr_cb[ch-1] = cb;
+	*can_tmr_ccr(ch) = (uint16_t)at;
+	*cctl = CCIE;
+	if ( (int32_t)(can_timer_now() - at) >= 0 )
+		*cctl |= CCIFG;  // Missed it; CCR wouldn't match again for a whole lap
+	__set_interrupt_state(sr);
+
+	return 0;
+}
+
+void can_timer_disarm(uint8_t ch)
+{
+	uint16_t sr;
+
+	if (ch < 1 || ch > CAN_TIMER_CHANNELS)
+		return;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	*can_tmr_cctl(ch) = 0;
+	can_tmr_cb[ch-1] = 0;
+	__set_interrupt_state(sr);
+}
+
+static uint8_t can_tmr_expire(uint8_t ch)
+{
+	can_timer_cb_t cb;
+
+	// CCR matches the low 16 bits once per lap; only the lap holding the deadline counts
+	if ( (int32_t)(can_timer_now() - can_tmr_deadline[ch-1]) < 0 )
+		return 0;
+
+	*can_tmr_cctl(ch) = 0;
+	cb = can_tmr_cb[ch-1];
+	can_tmr_cb[ch-1] = 0;
+	return cb ? cb() : 0;  // cb may re-arm the channel
+}
+
+/* Run from the application's TIMER0_A1_VECTOR ISR.  Services one pending source per call (the ISR is
+ * re-entered for the rest).  Returns nonzero if a callback asked for the CPU to be woken.
+ */
+uint8_t can_timer_irq()
+{
+	switch (TA0IV) {
+		case TA0IV_TACCR1:
+			return can_tmr_expire(1);
+#if CAN_TIMER_CHANNELS > 1
+		case TA0IV_TACCR2:
+			return can_tmr_expire(2);
+#endif
+		case TA0IV_TAIFG:
+			can_tmr_ovf++;
+			break;
+	}
+	return 0;
+}
@@ -0,0 +1,63 @@
+/* can_timer.h
+ * Timer_A timebase for the MCP2515 driver's timing features
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CAN_TIMER_H
+#define CAN_TIMER_H
+
+#include <stdint.h>
+
+/* User configuration */
+/* Timer_A0 runs continuously from this clock.  ACLK keeps counting in LPM3; with a 32768Hz crystal
+ * a tick is ~30.5us.  CAN_TIMER_HZ must match the clock and divider chosen.
+ */
+#define CAN_TIMER_TASSEL TASSEL_1
+#define CAN_TIMER_ID ID_0
+#define CAN_TIMER_HZ 32768UL
+
+// Compare channels past CCR0; the G2xx1 parts have Timer_A2, with CCR1 but no CCR2
+#if defined(__MSP430G2001__) || defined(__MSP430G2101__) || defined(__MSP430G2111__) || defined(__MSP430G2121__) || \
+    defined(__MSP430G2131__) || defined(__MSP430G2201__) || defined(__MSP430G2211__) || defined(__MSP430G2221__) || \
+    defined(__MSP430G2231__)
+#define CAN_TIMER_CHANNELS 1
+#else
+#define CAN_TIMER_CHANNELS 2
+#endif
+
+// Compile-time conversion of a constant # of microseconds to timer ticks, rounded up
+#define CAN_TIMER_US(us) ((uint32_t)(((uint64_t)(us) * CAN_TIMER_HZ + 999999UL) / 1000000UL))
+
+/* Compare channel callback, run from can_timer_irq() in interrupt context.
+ * Return nonzero to have the CPU woken up on exit from the ISR.
+ */
+typedef uint8_t (*can_timer_cb_t)(void);
+
+/* Function prototypes */
+void can_timer_init();
+uint32_t can_timer_now();
+uint32_t can_timer_ticks(uint32_t);
+int can_timer_arm(uint8_t, uint32_t, can_timer_cb_t);
+void can_timer_disarm(uint8_t);
+uint8_t can_timer_irq();
+
+#endif
@@ -0,0 +1,268 @@
+/* can_timesync.c
+ * Network clock synchronization over CAN for the MCP2515 driver
+ * Two-step scheme: the master sends a SYNC frame, then a FOLLOW_UP carrying the time
+ * that SYNC finished sending; slaves pair it with the time they received the SYNC.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_timesync.h"
+
+/* Network time at local time L is M0 + (L - L0) * (1 + drift / 2^24): an anchor pair of local and master
+ * times plus a fixed-point rate correction.  The anchor is only changed with interrupts off, so
+ * can_time_now() can be used from ISRs.
+ */
+static uint32_t can_ts_l0, can_ts_m0;
+static int32_t can_ts_drift;
+static uint8_t can_ts_state, can_ts_master;
+
+static uint32_t can_ts_lp, can_ts_mp;  // Previous raw pair, for measuring the rate
+static uint32_t can_ts_rx;             // When the last SYNC was received
+static uint8_t can_ts_seq, can_ts_pending;
+
+// Master: the SYNC in flight
+static uint32_t can_ts_txq;
+static uint8_t can_ts_txb;
+
+static struct can_timesync_stats can_ts_stats;
+
+/* master != 0 makes this node the time master; its own can_timer is the network time.
+ * can_timer_init() must have been run.
+ */
+void can_timesync_init(uint8_t master)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	can_ts_master = master;
+	can_ts_state = master ? CAN_TIMESYNC_LOCKED : CAN_TIMESYNC_UNSYNCED;
+	can_ts_l0 = can_ts_m0 = 0;
+	can_ts_drift = 0;
+	__set_interrupt_state(sr);
+	can_ts_seq = 0;
+	can_ts_pending = 0;
+	memset(&can_ts_stats, 0, sizeof(can_ts_stats));
+}
+
+static void can_ts_frame(struct can_frame *f, uint8_t type, uint8_t dlc)
+{
+	f->id = CAN_TIMESYNC_ID;
+	f->flags = 0;
+	f->prio = CAN_TIMESYNC_PRIO;
+	f->dlc = dlc;
+	f->data[0] = type;
+	f->data[1] = can_ts_seq;
+}
+
+/* Master: send a SYNC frame, e.g. once a second.  Its FOLLOW_UP goes out from can_timesync_poll().
+ * Returns the TXB used or -1 if none was free.
+ */
+int can_timesync_sync()
+{
+	struct can_frame f;
+	uint32_t done;
+	int txb;
+
+	if (can_ts_pending)
+		can_ts_stats.missed++;  // Previous FOLLOW_UP never went out
+	can_ts_pending = 0;
+
+	can_ts_seq++;
+	can_ts_frame(&f, CAN_TIMESYNC_SYNC, 2);
+	if ( (txb = can_frame_send(&f)) < 0 )
+		return -1;
+	can_tx_times(txb, &can_ts_txq, &done);
+	can_ts_txb = txb;
+	can_ts_pending = 1;
+	return txb;
+}
+
+/* Master: run from the main loop (after can_irq_handler() reports MCP2515_IRQ_TX is enough).  Once the SYNC
+ * has gone out, sends the FOLLOW_UP with the time TXnIF was raised.
+ * Returns 1 if the FOLLOW_UP was sent, 0 if there's nothing to do yet, -1 if no TXB was free (try again).
+ */
+int can_timesync_poll()
+{
+	struct can_frame f;
+	uint32_t queued, done;
+	int ret;
+
+	if (!can_ts_pending)
+		return 0;
+	if ( (ret = can_tx_times(can_ts_txb, &queued, &done)) == 1 )
+		return 0;
+	/* The TXB completed and was reused before we got here, or an RX claimed the IRQ edge and done is
+	 * only when can_irq_handler() noticed; either way this SYNC's time is gone.
+	 */
+	if (ret != 0 || queued != can_ts_txq) {
+		can_ts_pending = 0;
+		can_ts_stats.missed++;
+		return 0;
+	}
+
+	can_ts_frame(&f, CAN_TIMESYNC_FOLLOW_UP, 6);
+	f.data[2] = done;
+	f.data[3] = done >> 8;
+	f.data[4] = done >> 16;
+	f.data[5] = done >> 24;
+	if (can_frame_send(&f) < 0)
+		return -1;
+	can_ts_pending = 0;
+	can_ts_stats.syncs++;
+	return 1;
+}
+
+// Network time at local time l from the current anchor; interrupts are off or the anchor is stable
+static uint32_t can_ts_convert(uint32_t l, uint32_t l0, uint32_t m0, int32_t drift)
+{
+	int32_t dt = l - l0;
+
+	return m0 + dt + (int32_t)(((int64_t)dt * drift) >> 24);
+}
+
+// Slave: the master's clock read m when ours read l
+static void can_ts_update(uint32_t l, uint32_t m)
+{
+	uint16_t sr;
+	uint32_t p, m0 = m;
+	int32_t e = 0, drift = can_ts_drift, dl, meas;
+	uint8_t state = can_ts_state;
+
+	if (state == CAN_TIMESYNC_UNSYNCED) {
+		state = CAN_TIMESYNC_OFFSET;
+	} else {
+		p = can_ts_convert(l, can_ts_l0, can_ts_m0, can_ts_drift);
+		e = m - p;
+		if (e > CAN_TIMESYNC_STEP || e < -CAN_TIMESYNC_STEP) {
+			can_ts_stats.steps++;
+		} else {
+			dl = l - can_ts_lp;
+			if (dl > 0) {
+				meas = (int32_t)(((int64_t)(int32_t)((m - can_ts_mp) - (l - can_ts_lp)) << 24) / dl);
+				if (state == CAN_TIMESYNC_OFFSET)
+					drift = meas;
+				else
+					drift += (meas - drift) / (1 << CAN_TIMESYNC_DRIFT_SHIFT);
+				state = CAN_TIMESYNC_LOCKED;
+			}
+			m0 = p + e / (1 << CAN_TIMESYNC_OFFSET_SHIFT);
+		}
+	}
+
+	sr = __get_interrupt_state();
+	_DINT();
+	can_ts_l0 = l;
+	can_ts_m0 = m0;
+	can_ts_drift = drift;
+	can_ts_state = state;
+	__set_interrupt_state(sr);
+
+	can_ts_lp = l;
+	can_ts_mp = m;
+	can_ts_stats.error = e;
+	can_ts_stats.syncs++;
+}
+
+/* Slave: pass received frames in (can_frame.ts must be filled in, see can_rx_stamp()).
+ * Returns 1 if it was a SYNC or FOLLOW_UP, which the application can then ignore, else 0.
+ */
+uint8_t can_timesync_rx(const struct can_frame *f)
+{
+	uint32_t m;
+
+	if (f->id != CAN_TIMESYNC_ID || (f->flags & (CAN_FRAME_EXT | CAN_FRAME_RTR)) || f->dlc < 2)
+		return 0;
+	if (can_ts_master)
+		return 1;
+
+	if (f->data[0] == CAN_TIMESYNC_SYNC) {
+		can_ts_rx = f->ts;
+		can_ts_seq = f->data[1];
+		can_ts_pending = 1;
+	} else if (f->data[0] == CAN_TIMESYNC_FOLLOW_UP && f->dlc >= 6) {
+		if (!can_ts_pending || f->data[1] != can_ts_seq) {
+			can_ts_stats.missed++;
+			return 1;
+		}
+		can_ts_pending = 0;
+		m = f->data[2] | ((uint32_t)f->data[3] << 8) | ((uint32_t)f->data[4] << 16) | ((uint32_t)f->data[5] << 24);
+		can_ts_update(can_ts_rx, m);
+	}
+	return 1;
+}
+
+// Convert a local can_timer time, e.g. a can_frame.ts, to network time.  Safe to call from ISRs.
+uint32_t can_time_local(uint32_t l)
+{
+	uint16_t sr;
+	uint32_t l0, m0;
+	int32_t drift;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	if (can_ts_state == CAN_TIMESYNC_UNSYNCED || can_ts_master) {
+		__set_interrupt_state(sr);
+		return l;
+	}
+	l0 = can_ts_l0;
+	m0 = can_ts_m0;
+	drift = can_ts_drift;
+	__set_interrupt_state(sr);
+
+	return can_ts_convert(l, l0, m0, drift);
+}
+
+// Network time in can_timer ticks
+uint32_t can_time_now()
+{
+	return can_time_local(can_timer_now());
+}
+
+uint8_t can_timesync_state()
+{
+	return can_ts_state;
+}
+
+// Copy out the statistics; reset != 0 zeroes the counters.
+void can_timesync_getstats(struct can_timesync_stats *stats, uint8_t reset)
+{
+	uint16_t sr;
+	int32_t drift;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	memcpy(stats, &can_ts_stats, sizeof(*stats));
+	drift = can_ts_drift;
+	if (reset) {
+		can_ts_stats.syncs = 0;
+		can_ts_stats.steps = 0;
+		can_ts_stats.missed = 0;
+	}
+	__set_interrupt_state(sr);
+	stats->drift_ppb = (int32_t)(((int64_t)drift * 1000000000) >> 24);
+}
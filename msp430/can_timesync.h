@@ -0,0 +1,76 @@
+/* can_timesync.h
+ * Network clock synchronization over CAN for the MCP2515 driver
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CAN_TIMESYNC_H
+#define CAN_TIMESYNC_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+
+#if !defined(MCP2515_FRAME_TIMESTAMP) || !defined(MCP2515_TX_LATENCY)
+#error "can_timesync needs MCP2515_FRAME_TIMESTAMP and MCP2515_TX_LATENCY defined in mcp2515.h"
+#endif
+
+/* User configuration */
+// Standard ID and TX priority of the SYNC and FOLLOW_UP frames
+#define CAN_TIMESYNC_ID 0x010
+#define CAN_TIMESYNC_PRIO 3
+/* Filter gains, as right shifts: each sync corrects the clock by 1/2^n of its error and moves the drift
+ * estimate 1/2^n of the way to the newly measured rate.
+ */
+#define CAN_TIMESYNC_OFFSET_SHIFT 1
+#define CAN_TIMESYNC_DRIFT_SHIFT 2
+// Errors over this many ticks step the clock straight to the master's time instead
+#define CAN_TIMESYNC_STEP 64
+
+/* Frame layout: data[0] type, data[1] sequence#, FOLLOW_UP data[2-5] the SYNC's TX-complete time (LSB first) */
+#define CAN_TIMESYNC_SYNC 0x01
+#define CAN_TIMESYNC_FOLLOW_UP 0x02
+
+/* can_timesync_state() values */
+#define CAN_TIMESYNC_UNSYNCED 0  // can_time_now() is the local clock
+#define CAN_TIMESYNC_OFFSET 1    // One sync so far; offset known, drift not yet
+#define CAN_TIMESYNC_LOCKED 2    // Offset and drift tracked (always the case on the master)
+
+struct can_timesync_stats {
+	int32_t error;      // Last difference between the master's time and ours, in ticks
+	int32_t drift_ppb;  // Rate correction applied to our clock, parts per billion (negative if ours runs fast)
+	uint16_t syncs;     // SYNC/FOLLOW_UP pairs used
+	uint16_t steps;     // Times the clock was stepped
+	uint16_t missed;    // FOLLOW_UPs without a matching SYNC (slave) or not sent (master)
+};
+
+/* Function prototypes */
+void can_timesync_init(uint8_t);
+int can_timesync_sync();
+int can_timesync_poll();
+uint8_t can_timesync_rx(const struct can_frame *);
+uint32_t can_time_now();
+uint32_t can_time_local(uint32_t);
+uint8_t can_timesync_state();
+void can_timesync_getstats(struct can_timesync_stats *, uint8_t);
+
+#endif
@@ -25,6 +25,7 @@
  *  DEALINGS IN THE SOFTWARE.
  */
 #include <msp430.h>
+#include <string.h>
 #include "mcp2515.h"
 #include "ste2007.h"
 #include "chargen.h"
@@ -38,9 +39,9 @@ volatile uint16_t sleep_counter;
 
 int main()
 {
-	uint8_t do_lpm, is_ext;
-	int i, j, k;
-	uint32_t msgid;
+	uint8_t do_lpm;
+	int i, j, n;
+	struct can_frame frames[2];
 
 	WDTCTL = WDTPW | WDTHOLD;
 	DCOCTL = CALDCO_16MHZ;
@@ -148,15 +149,15 @@ int main()
 				}
 			}
 			if (irq & MCP2515_IRQ_RX) {
+				// Both RXBs drained with one status read; 2 frames max keeps inbuf from overflowing
 				j = 0;
-				k = can_rx_pending();
-				do {
-					i = can_recv(&msgid, &is_ext, inbuf+j);
-					if ( !(i & 0x40) ) {
-						j += i;
+				n = can_recv_batch(frames, 2);
+				for (i=0; i < n; i++) {
+					if ( !(frames[i].flags & CAN_FRAME_RTR) ) {
+						memcpy(inbuf+j, frames[i].data, frames[i].dlc);
+						j += frames[i].dlc;
 					}
-					//msp1202_putc(k + '0', 0); msp1202_putc(' ', 0);
-				} while ( (k = can_rx_pending()) >= 0 );
+				}
 				//inbuf[j++] = '\n'; inbuf[j] = '\0';
 				inbuf[j] = '\0';
 				msp1202_puts((char*)inbuf);
@@ -27,12 +27,126 @@
 #include <string.h>
 #include "mcp2515.h"
 #include "msp430_spi.h"
+#if defined(MCP2515_FRAME_TIMESTAMP) || defined(MCP2515_TX_LATENCY)
+#include "can_timer.h"
+#endif
+#ifdef MCP2515_BUSLOAD
+#include "can_busload.h"
+#endif
 
 /* Global variables used internally */
-uint8_t mcp2515_txb, mcp2515_ctrl, mcp2515_exmask;
+uint8_t mcp2515_txb, mcp2515_ctrl, mcp2515_exmask, mcp2515_flags;
+uint8_t mcp2515_txrsv;  // TXBs reserved for pre-loaded frames; also set in mcp2515_txb so can_send() skips them
+uint8_t mcp2515_txpin;  // Reserved TXBs started by their TXnRTS pin
+static const struct can_frame *mcp2515_txreload[3];  // Template contents to load once the TXB is done sending
+
+// mcp2515_flags bits
+#define MCP2515_FLAG_RXBF_PINS 0x01
 
 /* Global variable exposed externally for IRQ handling */
-volatile uint8_t mcp2515_irq, mcp2515_buf;
+volatile uint8_t mcp2515_irq, mcp2515_buf, mcp2515_rxbf;
+uint32_t mcp2515_bitrate;
+
+static volatile uint8_t mcp2515_lock;         // Driver lock depth
+static can_deferred_t mcp2515_deferred[MCP2515_DEFER_SLOTS];  // ISR jobs waiting for the lock
+static volatile uint8_t mcp2515_napi_on;      // Receive is being polled, IRQ pin interrupt masked
+static uint16_t mcp2515_napi_idle, mcp2515_napi_budget;
+
+#if defined(MCP2515_RX_CALLBACK) || defined(MCP2515_FILHIT_DISPATCH)
+static uint8_t mcp2515_rximg[13];
+#endif
+#ifdef MCP2515_RX_CALLBACK
+static can_rx_callback_t mcp2515_rx_cb;
+#endif
+#ifdef MCP2515_RX_ACCEPT_HOOK
+static can_rx_accept_t mcp2515_rx_accept;
+#endif
+#ifdef MCP2515_TX_FREE_HOOK
+static can_tx_free_t mcp2515_tx_free;
+#endif
+#ifdef MCP2515_FILHIT_DISPATCH
+static can_rx_callback_t mcp2515_filhit[6];  // Indexed by RXBnCTRL FILHIT, i.e. RXF0-RXF5
+static uint8_t mcp2515_filhit_bound;         // Bitmap of filters with a handler
+#endif
+
+#ifdef MCP2515_RTR_RESPONDER
+static struct can_rtr_responder *mcp2515_rtr;
+static uint8_t mcp2515_rtr_count;
+static uint16_t mcp2515_rtr_missed;  // Matching remote frames left unanswered for want of a TXB
+#endif
+#ifdef MCP2515_FRAME_TIMESTAMP
+static volatile uint32_t mcp2515_rxts[2], mcp2515_edgets;
+static volatile uint8_t mcp2515_rxts_set;  // BIT0/BIT1: RXB stamped, MCP2515_RXTS_EDGE: IRQ edge not yet claimed
+static uint32_t mcp2515_rxts_last;         // Stamp of the frame most recently fetched
+#endif
+#ifdef MCP2515_BUSLOAD
+static uint16_t mcp2515_txbits[3];  // On-wire length of the frame loaded in each TXB
+#endif
+#ifdef MCP2515_TX_LATENCY
+static uint32_t mcp2515_txq[3], mcp2515_txdone[3];  // Per TXB: when the last frame was requested and completed
+static uint8_t mcp2515_txprio[3];
+static uint8_t mcp2515_txtimed;                     // TXBs requested with a known time and not yet complete
+static uint8_t mcp2515_txedge;                      // TXBs whose mcp2515_txdone is their IRQ edge's time
+static uint16_t mcp2515_txhist[4][MCP2515_TXLAT_BUCKETS];
+#endif
+
+/* Driver lock
+ * Main loop calls only ever nest inside one another, and an ISR that gets the lock gives it back before
+ * returning, so taking and dropping an inner level needs no interrupt masking; only the outermost release
+ * does, since it has to look for deferred ISR jobs.
+ */
+
+void can_lock()
+{
+	mcp2515_lock++;
+}
+
+void can_unlock()
+{
+	uint16_t sr;
+	uint8_t i;
+	can_deferred_t job;
+
+	if (mcp2515_lock > 1) {
+		mcp2515_lock--;
+		return;
+	}
+
+	sr = __get_interrupt_state();
+	_DINT();
+	if (mcp2515_lock && !--mcp2515_lock) {
+		for (i=0; i < MCP2515_DEFER_SLOTS; i++) {
+			if ( (job = mcp2515_deferred[i]) != 0 ) {
+				mcp2515_deferred[i] = 0;
+				job();  // Takes the lock again with can_lock_isr()
+			}
+		}
+	}
+	__set_interrupt_state(sr);
+}
+
+/* Run from ISRs, before any driver call.  Returns 1 with the lock taken (drop it with can_unlock() before
+ * the ISR returns), or 0 if the main loop has the driver; job is then run by the main loop's can_unlock().
+ * Asking again for a job already waiting doesn't queue it twice.
+ */
+uint8_t can_lock_isr(can_deferred_t job)
+{
+	uint8_t i, slot = MCP2515_DEFER_SLOTS;
+
+	if (!mcp2515_lock) {
+		mcp2515_lock = 1;
+		return 1;
+	}
+	for (i=0; i < MCP2515_DEFER_SLOTS; i++) {
+		if (mcp2515_deferred[i] == job)
+			return 0;
+		if (!mcp2515_deferred[i] && slot == MCP2515_DEFER_SLOTS)
+			slot = i;
+	}
+	if (slot < MCP2515_DEFER_SLOTS)
+		mcp2515_deferred[slot] = job;
+	return 0;
+}
 
 /* SPI I/O */
 
@@ -41,19 +155,23 @@ volatile uint8_t mcp2515_irq, mcp2515_buf;
 
 void can_spi_command(uint8_t cmd)
 {
+	can_lock();
 	CAN_CS_LOW;
 	spi_transfer(cmd);
 	CAN_CS_HIGH;
+	can_unlock();
 }
 
 uint8_t can_spi_query(uint8_t cmd)
 {
 	uint8_t ret;
 
+	can_lock();
 	CAN_CS_LOW;
 	spi_transfer(cmd);
 	ret = spi_transfer(0xFF);
 	CAN_CS_HIGH;
+	can_unlock();
 	return ret;
 }
 
@@ -62,6 +180,7 @@ void can_r_reg(uint8_t addr, void *buf, uint8_t len)
 	uint16_t i;
 	uint8_t *sbuf = (uint8_t *)buf;
 
+	can_lock();
 	CAN_CS_LOW;
 	spi_transfer(MCP2515_SPI_READ);
 	spi_transfer(addr);
@@ -69,6 +188,7 @@ void can_r_reg(uint8_t addr, void *buf, uint8_t len)
 		sbuf[i] = spi_transfer(0xFF);
 	}
 	CAN_CS_HIGH;
+	can_unlock();
 }
 
 void can_w_reg(uint8_t addr, void *buf, uint8_t len)
@@ -76,6 +196,7 @@ void can_w_reg(uint8_t addr, void *buf, uint8_t len)
 	uint16_t i;
 	uint8_t *sbuf = (uint8_t *)buf;
 
+	can_lock();
 	CAN_CS_LOW;
 	spi_transfer(MCP2515_SPI_WRITE);
 	spi_transfer(addr);
@@ -83,16 +204,19 @@ void can_w_reg(uint8_t addr, void *buf, uint8_t len)
 		spi_transfer(sbuf[i]);
 	}
 	CAN_CS_HIGH;
+	can_unlock();
 }
 
 void can_w_bit(uint8_t addr, uint8_t mask, uint8_t val)
 {
+	can_lock();
 	CAN_CS_LOW;
 	spi_transfer(MCP2515_SPI_BITMOD);
 	spi_transfer(addr);
 	spi_transfer(mask);
 	spi_transfer(val);
 	CAN_CS_HIGH;
+	can_unlock();
 }
 
 void can_w_txbuf(uint8_t bufid, void *buf, uint8_t len)
@@ -100,12 +224,14 @@ void can_w_txbuf(uint8_t bufid, void *buf, uint8_t len)
 	uint16_t i;
 	uint8_t *sbuf = (uint8_t *)buf;
 
+	can_lock();
 	CAN_CS_LOW;
 	spi_transfer(MCP2515_SPI_LOAD_TXBUF | (bufid & 0x07));
 	for (i=0; i < len; i++) {
 		spi_transfer(sbuf[i]);
 	}
 	CAN_CS_HIGH;
+	can_unlock();
 }
 
 void can_r_rxbuf(uint8_t bufid, void *buf, uint8_t len)
@@ -113,12 +239,14 @@ void can_r_rxbuf(uint8_t bufid, void *buf, uint8_t len)
 	uint16_t i;
 	uint8_t *sbuf = (uint8_t *)buf;
 
+	can_lock();
 	CAN_CS_LOW;
 	spi_transfer(MCP2515_SPI_READ_RXBUF | (bufid & 0x06));
 	for (i=0; i < len; i++) {
 		sbuf[i] = spi_transfer(0xFF);
 	}
 	CAN_CS_HIGH;
+	can_unlock();
 }
 
 /* Main library - Maintenance functions */
@@ -151,12 +279,109 @@ void can_init()
 	can_w_reg(MCP2515_CANINTE, &ie, 1);
 
 	mcp2515_irq = 0x00;
+	mcp2515_rxbf = 0x00;
+	mcp2515_lock = 0;
+	memset(mcp2515_deferred, 0, sizeof(mcp2515_deferred));
+	mcp2515_napi_on = 0;
+	mcp2515_napi_budget = MCP2515_NAPI_BUDGET;
 	mcp2515_txb = 0x00;
 	mcp2515_exmask = 0x00;
+	mcp2515_flags = 0x00;
+	mcp2515_txrsv = 0x00;
+	mcp2515_txpin = 0x00;
+	memset(mcp2515_txreload, 0, sizeof(mcp2515_txreload));
+	mcp2515_bitrate = 0;
+#ifdef MCP2515_RX_CALLBACK
+	mcp2515_rx_cb = 0;
+#endif
+#ifdef MCP2515_FILHIT_DISPATCH
+	mcp2515_filhit_bound = 0;
+#endif
+#ifdef MCP2515_TX_FREE_HOOK
+	mcp2515_tx_free = 0;
+#endif
+#ifdef MCP2515_RX_ACCEPT_HOOK
+	mcp2515_rx_accept = 0;
+#endif
+#ifdef MCP2515_RTR_RESPONDER
+	mcp2515_rtr_count = 0;
+	mcp2515_rtr_missed = 0;
+#endif
+#ifdef MCP2515_FRAME_TIMESTAMP
+	mcp2515_rxts_set = 0;
+#endif
+#ifdef MCP2515_TX_LATENCY
+	mcp2515_txtimed = 0;
+	mcp2515_txedge = 0;
+	memset(mcp2515_txhist, 0, sizeof(mcp2515_txhist));
+#endif
 
 	_EINT();
 }
 
+/* Write CNF1-CNF2-CNF3 (cnf[0]-cnf[2]) with one burst read and one burst write of CNF3..CNF1, which
+ * sit together at 0x28-0x2A.  CNF3's SOF/WAKFIL and CNF2's SAM bits are kept.  Configuration mode only.
+ * bitrate is what the caller already knows cnf produces; it goes straight into mcp2515_bitrate.
+ */
+void can_cnf_write(const uint8_t *cnf, uint32_t bitrate)
+{
+	uint8_t regs[3];  // CNF3, CNF2, CNF1
+
+	can_lock();
+	can_r_reg(MCP2515_CNF3, regs, 3);
+	regs[0] = (regs[0] & ~MCP2515_CNF3_PHSEG_MASK) | (cnf[2] & MCP2515_CNF3_PHSEG_MASK);
+	regs[1] = (regs[1] & MCP2515_CNF2_SAM) | (cnf[1] & ~MCP2515_CNF2_SAM);
+	regs[2] = cnf[0];
+	can_w_reg(MCP2515_CNF3, regs, 3);
+	mcp2515_bitrate = bitrate;
+	can_unlock();
+}
+
+/* Load precomputed CNF1, CNF2, CNF3 values, e.g. from can_bittiming_solve(), along with the bitrate
+ * they produce.  Returns 0.
+ */
+int can_speed_cnf(const uint8_t *cnf, uint32_t bitrate)
+{
+	can_lock();
+	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
+		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
+
+	can_cnf_write(cnf, bitrate);
+
+	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
+		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
+	can_unlock();
+	return 0;
+}
+
+/* CNF values for the CAN_SPEED_* bitrates, all computed at compile time (see CAN_BT_CNF), each kept
+ * with its bitrate so nothing is worked out again at runtime
+ */
+static const struct {
+	uint8_t cnf[3];
+	uint32_t bitrate;
+} mcp2515_cnf_table[CAN_SPEED_COUNT] = {
+	{ CAN_BT_CNF(1000000UL), 1000000UL },
+	{ CAN_BT_CNF(800000UL), 800000UL },
+	{ CAN_BT_CNF(500000UL), 500000UL },
+	{ CAN_BT_CNF(250000UL), 250000UL },
+	{ CAN_BT_CNF(125000UL), 125000UL },
+	{ CAN_BT_CNF(100000UL), 100000UL },
+	{ CAN_BT_CNF(50000UL), 50000UL },
+	{ CAN_BT_CNF(20000UL), 20000UL },
+	{ CAN_BT_CNF(10000UL), 10000UL }
+};
+
+/* Switch to one of the CAN_SPEED_* bitrates from a compile-time table: no division at runtime, just one
+ * burst write of CNF1-CNF3.  Returns 0, or -1 if speed is invalid or CAN_OSC_FREQUENCY can't produce it.
+ */
+int can_speed_fast(uint8_t speed)
+{
+	if (speed >= CAN_SPEED_COUNT || !(mcp2515_cnf_table[speed].cnf[1] & MCP2515_CNF2_BTLMODE))
+		return -1;
+	return can_speed_cnf(mcp2515_cnf_table[speed].cnf, mcp2515_cnf_table[speed].bitrate);
+}
+
 /* Bitrate in Hz
  * propseg_hint in Time Quanta, 1-8
  * syncjump in Time Quanta, 1-4
@@ -164,8 +389,8 @@ void can_init()
 int can_speed(uint32_t bitrate, uint8_t propseg_hint, uint8_t syncjump)
 {
 	uint32_t a;
-	uint16_t brp = 0, tq_prop, tq_ps1, tq_ps2;
-	uint8_t c;
+	uint16_t brp = 0, ntq, tq_prop, tq_ps1, tq_ps2;
+	uint8_t cnf[3];
 
 	// Sanity check
 	if (!bitrate || bitrate > 1000000)
@@ -187,6 +412,7 @@ int can_speed(uint32_t bitrate, uint8_t propseg_hint, uint8_t syncjump)
 	if (a < 8)
 		return -1;  // Invalid speed
 
+	ntq = a;
 	a -= 1;  // Sync Seg fixed at 1 TQ
 	if ( (a - propseg_hint) < 3 )
 		propseg_hint = a - 3;
@@ -205,18 +431,10 @@ int can_speed(uint32_t bitrate, uint8_t propseg_hint, uint8_t syncjump)
 		syncjump = tq_ps2 - 1;
 
 	// Configure BRP, SJW, TQ_PropSeg, TQ_PS1, TQ_PS2
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
-		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
-
-	c = ((brp - 1) & 0x3F) | ((syncjump - 1) << 6);
-	can_w_reg(MCP2515_CNF1, &c, 1);
-	can_w_bit(MCP2515_CNF2, MCP2515_CNF2_PRSEG_MASK | MCP2515_CNF2_PHSEG_MASK | MCP2515_CNF2_BTLMODE,
-			  MCP2515_CNF2_BTLMODE | (tq_prop-1) | ((tq_ps1-1) << 3));
-	can_w_bit(MCP2515_CNF3, MCP2515_CNF3_PHSEG_MASK, tq_ps2-1);
-
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
-		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
-	return 0;
+	cnf[0] = ((brp - 1) & 0x3F) | ((syncjump - 1) << 6);
+	cnf[1] = MCP2515_CNF2_BTLMODE | (tq_prop-1) | ((tq_ps1-1) << 3);
+	cnf[2] = tq_ps2-1;
+	return can_speed_cnf(cnf, CAN_OSC_FREQUENCY / (2UL * brp * ntq));
 }
 
 /* Standard IDs can contain extended bits, but EXIDE is cleared.  This is to support
@@ -276,109 +494,456 @@ uint32_t can_parse_msgid(uint8_t *buf)
 
 /* CAN message transmission */
 
-int can_send(uint32_t msg, uint8_t is_ext, void *buf, uint8_t len, uint8_t prio)
+// Switch to NORMAL mode unless we're already in a mode that can transmit.
+static void can_tx_opmode()
+{
+	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_NORMAL &&
+		 (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_LOOPBACK ) {
+		mcp2515_ctrl &= ~MCP2515_CANCTRL_REQOP_MASK;
+		can_w_reg(MCP2515_CANCTRL, &mcp2515_ctrl, 1);
+	}
+}
+
+/* TXBnCTRL, SIDH..EID0, DLC and data are contiguous; load the priority, 4 ID bytes, DLC and data in
+ * one WRITE transaction.  A Standard ID carrying SRR in SIDL (as received) is sent with RTR set in DLC,
+ * which is where the TX side wants it for both Standard and Extended frames.
+ */
+static void can_tx_load(uint8_t txb, uint8_t prio, const uint8_t *idbuf, uint8_t dlc, const uint8_t *data)
+{
+	uint8_t i, len;
+#ifdef MCP2515_BUSLOAD
+	uint8_t hdr[5];
+#endif
+
+#ifdef MCP2515_TX_LATENCY
+	mcp2515_txprio[txb] = prio & 0x03;
+#endif
+	if ( (idbuf[1] & 0x18) == 0x10 )
+		dlc |= 0x40;
+	len = dlc & 0x0F;
+	if (len > 8)
+		len = 8;
+#ifdef MCP2515_BUSLOAD
+	memcpy(hdr, idbuf, 4);
+	hdr[4] = dlc;
+	mcp2515_txbits[txb] = can_busload_bits(hdr, data);
+#endif
+
+	CAN_CS_LOW;
+	spi_transfer(MCP2515_SPI_WRITE);
+	spi_transfer(MCP2515_TXB0CTRL + 0x10*txb);
+	spi_transfer(prio);
+	for (i=0; i < 4; i++)
+		spi_transfer(idbuf[i]);
+	spi_transfer(dlc);
+	for (i=0; i < len; i++)
+		spi_transfer(data[i]);
+	CAN_CS_HIGH;
+}
+
+// Load a struct can_frame into the specified TXB without requesting transmission.
+static void can_tx_load_frame(uint8_t txb, const struct can_frame *f)
+{
+	uint8_t idbuf[4];
+
+	if (f->flags & CAN_FRAME_EXT)
+		can_compose_msgid_ext(f->id, idbuf);
+	else
+		can_compose_msgid_std(f->id, idbuf);
+	can_tx_load(txb, f->prio, idbuf, (f->flags & CAN_FRAME_RTR) ? (f->dlc | 0x40) : f->dlc, f->data);
+}
+
+#ifdef MCP2515_TX_LATENCY
+/* Transmit latency
+ * A frame's clock starts when its RTS goes out and stops when its TXnIF is seen, so the latency covers
+ * waiting for arbitration, retries and however long it took can_irq_handler() to notice.  Frames started
+ * by a TXnRTS pin have no known start and aren't counted.
+ */
+static void can_tx_queued(uint8_t txbmask)
+{
+	uint8_t i;
+	uint32_t now = can_timer_now();
+
+	for (i=0; i < 3; i++) {
+		if (txbmask & (1 << i))
+			mcp2515_txq[i] = now;
+	}
+	mcp2515_txtimed |= txbmask;
+	mcp2515_txedge &= ~txbmask;
+}
+
+static void can_tx_done(uint8_t txbmask, uint32_t at)
+{
+	uint8_t i, b;
+	uint32_t lat;
+
+	txbmask &= mcp2515_txtimed;
+	for (i=0; i < 3; i++) {
+		if ( !(txbmask & (1 << i)) )
+			continue;
+		mcp2515_txdone[i] = at;
+		lat = at - mcp2515_txq[i];
+		for (b=0; lat && b < MCP2515_TXLAT_BUCKETS-1; b++)
+			lat >>= 1;
+		if (mcp2515_txhist[mcp2515_txprio[i]][b] != 0xFFFF)
+			mcp2515_txhist[mcp2515_txprio[i]][b]++;
+	}
+	mcp2515_txtimed &= ~txbmask;
+}
+
+/* Request and completion times (can_timer ticks) of the last timed frame sent from txb.
+ * Returns 0, 1 if that frame is still waiting to go out (*done is then stale), 2 if *done is only when
+ * can_irq_handler() got to it because no IRQ edge time was left for it, or -1 if txb is invalid.
+ */
+int can_tx_times(uint8_t txb, uint32_t *queued, uint32_t *done)
+{
+	if (txb > 2)
+		return -1;
+	*queued = mcp2515_txq[txb];
+	*done = mcp2515_txdone[txb];
+	if (mcp2515_txtimed & (1 << txb))
+		return 1;
+	return (mcp2515_txedge & (1 << txb)) ? 0 : 2;
+}
+
+/* Copy the MCP2515_TXLAT_BUCKETS latency counts for TX priority prio (0-3) into hist; counts stick at
+ * 65535.  A nonzero reset clears that priority's histogram.  Returns 0, or -1 if prio is invalid.
+ */
+int can_tx_latency(uint8_t prio, uint16_t *hist, uint8_t reset)
+{
+	if (prio > 3)
+		return -1;
+	memcpy(hist, mcp2515_txhist[prio], sizeof(mcp2515_txhist[prio]));
+	if (reset)
+		memset(mcp2515_txhist[prio], 0, sizeof(mcp2515_txhist[prio]));
+	return 0;
+}
+#endif
+
+#ifdef MCP2515_BUSLOAD
+// Count the frames TXBs in txbmask just finished sending
+static void can_tx_busload(uint8_t txbmask)
+{
+	uint8_t i;
+
+	for (i=0; i < 3; i++) {
+		if (txbmask & (1 << i))
+			can_busload_add(mcp2515_txbits[i]);
+	}
+}
+#endif
+
+/* Send a frame on the next available TX buffer.  RTR frames carry no data but do carry their DLC.
+ * Returns the TXB# used or -1 if no TXB was available or the frame is invalid.
+ */
+int can_frame_send(const struct can_frame *f)
 {
 	int txb;
-	uint8_t outbuf[13];
 
-	if (len > 8 || prio > 3)
+	if (f->dlc > 8 || f->prio > 3)
 		return -1;
 
+	can_lock();
 	// Choose an available TX buffer
-	if ( (txb = can_tx_available()) < 0 )
+	if ( (txb = can_tx_available()) < 0 ) {
+		can_unlock();
 		return -1;
+	}
 	mcp2515_txb |= 1 << txb;
 
 	// Make sure we're in the right operational mode
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_NORMAL &&
-		 (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_LOOPBACK ) {
-		mcp2515_ctrl &= ~MCP2515_CANCTRL_REQOP_MASK;
-		can_w_reg(MCP2515_CANCTRL, &mcp2515_ctrl, 1);
-	}
-	
-	// Sending an Extended message?
-	if (is_ext)
-		can_compose_msgid_ext(msg, outbuf);
-	else
-		can_compose_msgid_std(msg, outbuf);
-	
-	// Load buffer & send
-	outbuf[4] = len;
-	memcpy(outbuf+5, (uint8_t *)buf, len);
+	can_tx_opmode();
 
-	can_w_reg(MCP2515_TXB0CTRL + 0x10*txb, &prio, 1);
-	can_w_txbuf(MCP2515_TXBUF_TXB0SIDH + 2*txb, outbuf, 5+len);
+	// Load buffer & send
+	can_tx_load_frame(txb, f);
 	can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << txb, MCP2515_CANINTE_TX0IE << txb);
-	//can_w_bit(MCP2515_TXB0CTRL + 0x10*txb, MCP2515_TXBCTRL_TXREQ, MCP2515_TXBCTRL_TXREQ);
-	can_spi_command(MCP2515_SPI_RTS | mcp2515_txb);  // Initiate transmission
+	can_spi_command(MCP2515_SPI_RTS | (1 << txb));  // Initiate transmission
+#ifdef MCP2515_TX_LATENCY
+	can_tx_queued(1 << txb);
+#endif
+	can_unlock();
 
 	return txb;
 }
 
-// SRR or RTR ... zero-byte frame requesting the specified msg be returned
-int can_query(uint32_t msg, uint8_t is_ext, uint8_t prio)
+int can_send(uint32_t msg, uint8_t is_ext, void *buf, uint8_t len, uint8_t prio)
+{
+	struct can_frame f;
+
+	if (len > 8)
+		return -1;
+
+	f.id = msg;
+	f.flags = is_ext ? CAN_FRAME_EXT : 0;
+	f.dlc = len;
+	f.prio = prio;
+	memcpy(f.data, (uint8_t *)buf, len);
+	return can_frame_send(&f);
+}
+
+/* Load as many frames as there are free TX buffers and start them all with a single RTS.
+ * One READ STATUS is used to reclaim TX buffers whose transmission already completed, so
+ * bursty senders don't need a can_irq_handler() pass per frame to free up a TXB.
+ * Returns the # of frames loaded (0 if no TXB was free), or -1 if frames[0] is invalid.
+ */
+int can_send_batch(struct can_frame *frames, uint8_t n)
+{
+	uint8_t i, status, done = 0, loaded = 0, sent = 0;
+	struct can_frame *f;
+
+	if (!n)
+		return 0;
+
+	can_lock();
+	// Reclaim TXBs that have finished since the IRQ handler last looked
+	status = can_spi_query(MCP2515_SPI_READ_STATUS);
+	for (i=0; i < 3; i++) {
+		if ( (mcp2515_txb & ~mcp2515_txrsv & (1 << i)) && (status & (MCP2515_STATUS_TX0IF << 2*i)) )
+			done |= 1 << i;
+	}
+	if (done) {
+		can_w_bit(MCP2515_CANINTF, done << 2, 0);  // TX0IF..TX2IF are CANINTF bits 2-4
+		mcp2515_txb &= ~done;
+#ifdef MCP2515_TX_LATENCY
+		can_tx_done(done, can_timer_now());
+#endif
+#ifdef MCP2515_BUSLOAD
+		can_tx_busload(done);
+#endif
+	}
+
+	can_tx_opmode();
+
+	for (i=0; i < 3 && sent < n; i++) {
+		if (mcp2515_txb & (1 << i))
+			continue;
+		f = &frames[sent];
+		if (f->dlc > 8 || f->prio > 3) {
+			if (!sent) {
+				can_unlock();
+				return -1;
+			}
+			break;
+		}
+		can_tx_load_frame(i, f);
+		loaded |= 1 << i;
+		sent++;
+	}
+
+	if (loaded) {
+		mcp2515_txb |= loaded;
+		can_w_bit(MCP2515_CANINTE, loaded << 2, loaded << 2);  // TX0IE..TX2IE
+		can_spi_command(MCP2515_SPI_RTS | loaded);
+#ifdef MCP2515_TX_LATENCY
+		can_tx_queued(loaded);
+#endif
+	}
+#ifdef MCP2515_TX_FREE_HOOK
+	// Reclaimed TXBs this batch didn't refill are free, same as if can_irq_handler() had found them
+	if (mcp2515_tx_free) {
+		for (i=0; i < 3; i++) {
+			if ( (done & ~loaded & (1 << i)) && !(mcp2515_txb & (1 << i)) )
+				mcp2515_tx_free(i);  // May have taken the next one with can_send()
+		}
+	}
+#endif
+	can_unlock();
+
+	return sent;
+}
+
+/* Send a frame already in MCP2515 register layout, e.g. one received with can_recv_raw().
+ * No message ID conversion takes place.
+ */
+int can_send_raw(const struct can_raw_frame *frame, uint8_t prio)
 {
 	int txb;
-	uint8_t outbuf[13];
 
-	if (prio > 3)
+	if ( (frame->dlc & 0x0F) > 8 || prio > 3 )
 		return -1;
 
-	// Choose an available TX buffer
-	if ( !(mcp2515_txb & BIT0) )
-		txb = 0;
-	else if ( !(mcp2515_txb & BIT1) )
-		txb = 1;
-	else if ( !(mcp2515_txb & BIT2) )
-		txb = 2;
-	else
+	can_lock();
+	if ( (txb = can_tx_available()) < 0 ) {
+		can_unlock();
 		return -1;
+	}
 	mcp2515_txb |= 1 << txb;
 
-	// Make sure we're in the right operational mode
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_NORMAL &&
-		 (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_LOOPBACK ) {
-		mcp2515_ctrl &= ~MCP2515_CANCTRL_REQOP_MASK;
-		can_w_reg(MCP2515_CANCTRL, &mcp2515_ctrl, 1);
-	}
-	
-	// Sending an Extended message?
-	if (is_ext) {
-		can_compose_msgid_ext(msg, outbuf);
-		outbuf[4] = 0x40;  // RTR=1, data length = 0
-	} else {
-		can_compose_msgid_std(msg, outbuf);
-		outbuf[1] |= 0x10; // SRR=1
-	}
-	
-	// Send
-	can_w_reg(MCP2515_TXB0CTRL + 0x10*txb, &prio, 1);
-	can_w_txbuf(MCP2515_TXBUF_TXB0SIDH + 2*txb, outbuf, 5);
+	can_tx_opmode();
+
+	can_tx_load(txb, prio, (const uint8_t *)frame, frame->dlc, frame->data);
 	can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << txb, MCP2515_CANINTE_TX0IE << txb);
-	//can_w_bit(MCP2515_TXB0CTRL + 0x10*txb, MCP2515_TXBCTRL_TXREQ, MCP2515_TXBCTRL_TXREQ);
-	can_spi_command(MCP2515_SPI_RTS);  // Initiate transmission
+	can_spi_command(MCP2515_SPI_RTS | (1 << txb));
+#ifdef MCP2515_TX_LATENCY
+	can_tx_queued(1 << txb);
+#endif
+	can_unlock();
 
 	return txb;
 }
 
-// Returns -1 if no TXB's were active
+// RTR ... zero-byte frame requesting the specified msg be returned
+int can_query(uint32_t msg, uint8_t is_ext, uint8_t prio)
+{
+	struct can_frame f;
+
+	f.id = msg;
+	f.flags = CAN_FRAME_RTR | (is_ext ? CAN_FRAME_EXT : 0);
+	f.dlc = 0;
+	f.prio = prio;
+	return can_frame_send(&f);
+}
+
+// Returns -1 if no TXB's were active.  Reserved (pre-loaded) TXBs are left alone.
 int can_tx_cancel()
 {
-	uint8_t i, work_done = -1;
+	int work_done = -1;
+	uint8_t i;
 	
+	can_lock();
 	for (i=0; i < 3; i++) {
-		if (mcp2515_txb & (1 << i)) {
+		if (mcp2515_txb & ~mcp2515_txrsv & (1 << i)) {
 			// Cancel TXREQ bit
 			can_w_bit(MCP2515_TXB0CTRL + 0x10*i, MCP2515_TXBCTRL_TXREQ, 0x00);
 			// Disable IRQ for this TXB
 			can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_TX0IF << i, 0x00);
 			can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << i, 0x00);
+			mcp2515_txb &= ~(1 << i);
+#ifdef MCP2515_TX_LATENCY
+			mcp2515_txtimed &= ~(1 << i);
+#endif
 			work_done = 0;
 		}
 	}
+	can_unlock();
 	return work_done;
 }
 
+/* Hand the TXBs in txbmask (bit 0 = TXB0 .. bit 2 = TXB2) over to their TXnRTS pins.  A falling edge on
+ * TXnRTS, e.g. from a Timer_A output, then starts whatever frame was pre-loaded with can_tx_preload()
+ * without any SPI traffic.  Those TXBs are reserved and no longer used by can_send().  Buffers leaving
+ * pin mode are released.  Takes a trip through CONFIGURATION mode since TXRTSCTRL is only writable there.
+ */
+int can_tx_pin_mode(uint8_t txbmask)
+{
+	uint8_t release;
+
+	if (txbmask & ~0x07)
+		return -1;
+	can_lock();
+	if (txbmask & mcp2515_txb & ~mcp2515_txrsv) {
+		can_unlock();
+		return -1;  // Busy with a regular transmission
+	}
+
+	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
+		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
+
+	can_w_bit(MCP2515_TXRTSCTRL, MCP2515_TXRTSCTRL_B0RTSM | MCP2515_TXRTSCTRL_B1RTSM | MCP2515_TXRTSCTRL_B2RTSM, txbmask);
+
+	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
+		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
+
+	release = mcp2515_txpin & ~txbmask;
+	mcp2515_txpin = txbmask;
+	mcp2515_txrsv |= txbmask;
+	mcp2515_txb |= txbmask;
+	can_tx_release(release);
+	can_unlock();
+
+	return 0;
+}
+
+/* Reserve txb as a transmit template and pre-load it with a frame.  Firing the template with
+ * can_tx_fire() then costs a single RTS byte on SPI.  The MCP2515 keeps the frame in the buffer after
+ * sending it and the IRQ handler re-arms the buffer, so a template can be fired again and again.
+ * Calling can_tx_template() again on a reserved TXB replaces its frame; if the TXB is still waiting to
+ * send, the new frame is loaded by the IRQ handler once it completes (f must stay valid until then).
+ * The other TXBs keep serving can_send().
+ * Returns txb, or -1 if txb is busy with a regular transmission or the frame is invalid.
+ */
+int can_tx_template(uint8_t txb, const struct can_frame *f)
+{
+	if (txb > 2 || f->dlc > 8 || f->prio > 3)
+		return -1;
+	can_lock();
+	if ( !(mcp2515_txrsv & (1 << txb)) ) {
+		if (mcp2515_txb & (1 << txb)) {
+			can_unlock();
+			return -1;
+		}
+		mcp2515_txb |= 1 << txb;
+		mcp2515_txrsv |= 1 << txb;
+	}
+	mcp2515_txreload[txb] = 0;
+	if (can_tx_preload(txb, f) < 0)
+		mcp2515_txreload[txb] = f;  // In flight; reload after TXnIF
+	can_unlock();
+	return txb;
+}
+
+// Start the reserved TXBs in txbmask (bit 0 = TXB0 .. bit 2 = TXB2) with one RTS byte.
+void can_tx_fire(uint8_t txbmask)
+{
+	can_lock();
+	can_spi_command(MCP2515_SPI_RTS | (txbmask & mcp2515_txrsv));
+#ifdef MCP2515_TX_LATENCY
+	can_tx_queued(txbmask & mcp2515_txrsv);
+#endif
+	can_unlock();
+}
+
+// Give reserved TXBs in txbmask back to can_send().  Use can_tx_pin_mode() for those in pin mode.
+void can_tx_release(uint8_t txbmask)
+{
+	uint8_t i;
+
+	can_lock();
+	txbmask &= mcp2515_txrsv & ~mcp2515_txpin;
+	if (!txbmask) {
+		can_unlock();
+		return;
+	}
+	can_w_bit(MCP2515_CANINTE, txbmask << 2, 0);  // TX0IE..TX2IE
+	can_w_bit(MCP2515_CANINTF, txbmask << 2, 0);  // TX0IF..TX2IF
+	mcp2515_txrsv &= ~txbmask;
+	mcp2515_txb &= ~txbmask;
+#ifdef MCP2515_TX_LATENCY
+	mcp2515_txtimed &= ~txbmask;
+#endif
+	for (i=0; i < 3; i++) {
+		if (txbmask & (1 << i))
+			mcp2515_txreload[i] = 0;
+	}
+	can_unlock();
+}
+
+/* Load a frame into a reserved TXB without requesting transmission.  The frame stays in the buffer after
+ * it goes out, so it only needs loading again when its contents change.
+ * Returns -1 if txb isn't reserved or is still waiting to transmit its previous frame.
+ */
+int can_tx_preload(uint8_t txb, const struct can_frame *f)
+{
+	uint8_t ctrl;
+
+	if (txb > 2 || !(mcp2515_txrsv & (1 << txb)))
+		return -1;
+	if (f->dlc > 8 || f->prio > 3)
+		return -1;
+	can_lock();
+	can_r_reg(MCP2515_TXB0CTRL + 0x10*txb, &ctrl, 1);
+	if (ctrl & MCP2515_TXBCTRL_TXREQ) {
+		can_unlock();
+		return -1;
+	}
+
+	can_tx_opmode();
+	can_tx_load_frame(txb, f);
+	can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << txb, MCP2515_CANINTE_TX0IE << txb);
+	can_unlock();
+	return txb;
+}
+
 // Returns available TXB if one is available, else -1 indicating the user must wait to TX.
 int can_tx_available()
 {
@@ -395,34 +960,283 @@ int can_tx_available()
 
 /* CAN message receive */
 
-// Returns length of packet or -1 if nothing to read
-int can_recv(uint32_t *msgid, uint8_t *is_ext, void *buf)
+#ifdef MCP2515_FRAME_TIMESTAMP
+/* Receive timestamps
+ * The pin ISRs call can_rx_stamp() the moment an interrupt edge comes in.  With MCP2515_OPTION_RXBF_PINS
+ * each RXB has its own pin, so every frame gets the time its buffer filled, even back to back.  On the
+ * shared IRQ pin an edge only says something happened; it is claimed by the first RXB read after it,
+ * and an RXB that filled while the line was already low gets the time it was first seen instead.
+ */
+void can_rx_stamp(uint8_t which)
+{
+	uint32_t now = can_timer_now();
+
+	if (which & MCP2515_RXTS_EDGE)
+		mcp2515_edgets = now;
+	if (which & BIT0)
+		mcp2515_rxts[0] = now;
+	if (which & BIT1)
+		mcp2515_rxts[1] = now;
+	mcp2515_rxts_set |= which & (MCP2515_RXTS_EDGE | BIT0 | BIT1);
+}
+
+/* Resolve the stamp of the frame in rxb into mcp2515_rxts_last.  consume != 0 when the frame is being
+ * taken out of the RXB, so the next frame there starts fresh.
+ */
+static void can_rx_ts(uint8_t rxb, uint8_t consume)
+{
+	uint16_t sr;
+
+	sr = __get_interrupt_state();
+	_DINT();
+	if ( !(mcp2515_rxts_set & (1 << rxb)) ) {
+		if (mcp2515_rxts_set & MCP2515_RXTS_EDGE) {
+			mcp2515_rxts[rxb] = mcp2515_edgets;
+			mcp2515_rxts_set &= ~MCP2515_RXTS_EDGE;
+		} else {
+			mcp2515_rxts[rxb] = can_timer_now();
+		}
+		mcp2515_rxts_set |= 1 << rxb;
+	}
+	mcp2515_rxts_last = mcp2515_rxts[rxb];
+	if (consume)
+		mcp2515_rxts_set &= ~(1 << rxb);
+	__set_interrupt_state(sr);
+}
+
+// Timestamp of the frame last read, e.g. from within a can_rx_callback() handler
+uint32_t can_rx_lastts()
+{
+	return mcp2515_rxts_last;
+}
+#endif
+
+/* Read RXB header plus only as many data bytes as its DLC calls for.  The controller clears RXnIF
+ * itself when CS rises after a READ RX BUFFER instruction, so no BITMOD is needed afterward.
+ * Returns 0 if the accept hook turned the frame down after the header, which frees the RXB all the same.
+ */
+static uint8_t can_rx_fetch(uint8_t rxb, uint8_t *img)
+{
+	uint8_t i, len;
+
+#ifdef MCP2515_FRAME_TIMESTAMP
+	can_rx_ts(rxb, 1);
+#endif
+	CAN_CS_LOW;
+	spi_transfer(MCP2515_SPI_READ_RXBUF | (rxb ? MCP2515_RXBUF_RXB1SIDH : MCP2515_RXBUF_RXB0SIDH));
+	for (i=0; i < 5; i++)
+		img[i] = spi_transfer(0xFF);
+#ifdef MCP2515_RX_ACCEPT_HOOK
+	if (mcp2515_rx_accept && !mcp2515_rx_accept(img)) {
+		CAN_CS_HIGH;
+#ifdef MCP2515_BUSLOAD
+		can_busload_add(can_busload_bits(img, 0));
+#endif
+		return 0;
+	}
+#endif
+	len = img[4] & 0x0F;
+	if (len > 8)
+		len = 8;
+	for (i=0; i < len; i++)
+		img[5+i] = spi_transfer(0xFF);
+	CAN_CS_HIGH;
+#ifdef MCP2515_BUSLOAD
+	can_busload_add(can_busload_bits(img, img+5));
+#endif
+	return 1;
+}
+
+/* Decode an RXB image.  RTR lives in DLC for Extended frames and in SIDL (SRR) for Standard frames. */
+static void can_frame_parse(const uint8_t *img, struct can_frame *f)
+{
+	f->id = can_parse_msgid((uint8_t *)img);
+	f->dlc = img[4] & 0x0F;
+	if (f->dlc > 8)
+		f->dlc = 8;
+	f->prio = 0;
+	if (img[1] & 0x08)
+		f->flags = CAN_FRAME_EXT | ((img[4] & 0x40) ? CAN_FRAME_RTR : 0);
+	else
+		f->flags = (img[1] & 0x10) ? CAN_FRAME_RTR : 0;
+	memcpy(f->data, img+5, f->dlc);
+#ifdef MCP2515_FRAME_TIMESTAMP
+	f->ts = mcp2515_rxts_last;
+#endif
+}
+
+// Returns RXB# the frame was read from or -1 if nothing to read
+int can_frame_recv(struct can_frame *f)
 {
 	uint8_t msginbuf[13];
-	int rxb = -1;
+	int rxb;
 
-	// Any of them have unread data?
-	rxb = can_rx_pending();
-	if (rxb < 0)
+	can_lock();
+	// Any of them have unread data?  Frames dropped by the accept hook don't count.
+	while ( (rxb = can_rx_pending()) >= 0 ) {
+		if (can_rx_fetch(rxb, msginbuf)) {
+			can_frame_parse(msginbuf, f);
+			break;
+		}
+	}
+	can_unlock();
+	return rxb;
+}
+
+/* Read the specified RXB without consulting CANINTF first; meant for use with MCP2515_OPTION_RXBF_PINS,
+ * where the RXnBF pin that fired already says which buffer is full.  Reading the buffer clears RXnIF,
+ * which releases the pin.  Returns rxb or -1 if rxb is invalid or the accept hook dropped the frame.
+ */
+int can_frame_recv_rxb(uint8_t rxb, struct can_frame *f)
+{
+	uint8_t msginbuf[13];
+
+	if (rxb > 1)
 		return -1;
 
-	// Pull down the message
-	can_r_rxbuf(MCP2515_RXBUF_RXB0SIDH + 0x04*rxb, msginbuf, 13);
-	// To reduce risk of RXB overflow, acknowledge IRQ right away.
-	can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_RX0IF + rxb, 0x00);
+	mcp2515_rxbf &= ~(1 << rxb);
+	can_lock();
+	if (!can_rx_fetch(rxb, msginbuf)) {
+		can_unlock();
+		return -1;
+	}
+	can_unlock();
+	can_frame_parse(msginbuf, f);
+	return rxb;
+}
 
-	*msgid = can_parse_msgid(msginbuf);
-	if (msginbuf[1] & 0x08)
-		*is_ext = 1;
-	else
-		*is_ext = 0;
-	memcpy((uint8_t *)buf, msginbuf+5, msginbuf[4] & 0x0F);
+// Returns length of packet or -1 if nothing to read
+int can_recv(uint32_t *msgid, uint8_t *is_ext, void *buf)
+{
+	struct can_frame f;
+
+	if (can_frame_recv(&f) < 0)
+		return -1;
+
+	*msgid = f.id;
+	*is_ext = (f.flags & CAN_FRAME_EXT) ? 1 : 0;
+	memcpy((uint8_t *)buf, f.data, f.dlc);
 
 	// Present RTR or SRR bit as 0x40
-	if (is_ext)
-		return msginbuf[4] & 0x4F;
-	else
-		return (msginbuf[4] & 0x0F) | ((msginbuf[1] & 0x10) << 2);
+	return f.dlc | ((f.flags & CAN_FRAME_RTR) ? 0x40 : 0);
+}
+
+/* Drain every full RX buffer into frames[], up to max frames.  One READ STATUS covers both RXBs
+ * per pass; RXB0 is read first since with ROLLOVER it always holds the older frame.
+ * Returns the # of frames read, 0 if nothing was pending.
+ */
+int can_recv_batch(struct can_frame *frames, uint8_t max)
+{
+	uint8_t rxb, pending, got = 0;
+	uint8_t msginbuf[13];
+
+	can_lock();
+	while (got < max) {
+		pending = can_spi_query(MCP2515_SPI_READ_STATUS) & (MCP2515_STATUS_RX0IF | MCP2515_STATUS_RX1IF);
+		if (!pending)
+			break;
+
+		for (rxb=0; rxb < 2 && got < max; rxb++) {
+			if ( !(pending & (1 << rxb)) )
+				continue;
+			if (can_rx_fetch(rxb, msginbuf))
+				can_frame_parse(msginbuf, &frames[got++]);
+		}
+	}
+	can_unlock();
+
+	return got;
+}
+
+/* Pull down the first full RX buffer untouched, in MCP2515 register layout.
+ * Returns the RXB# read or -1 if nothing was pending.
+ */
+int can_recv_raw(struct can_raw_frame *frame)
+{
+	int rxb;
+
+	can_lock();
+	while ( (rxb = can_rx_pending()) >= 0 ) {
+		if (can_rx_fetch(rxb, (uint8_t *)frame))
+			break;
+	}
+	can_unlock();
+	return rxb;
+}
+
+/* Hybrid interrupt/polled receive.  At low rates every frame costs an IRQ pin interrupt and a pass
+ * through can_irq_handler(), which is fine and lets the CPU sleep.  Under a burst that per-frame
+ * overhead dominates, so the IRQ pin ISR calls can_napi_schedule() instead of flagging mcp2515_irq:
+ * the pin interrupt is masked and the main loop drains the RXBs with can_napi_poll() until they have
+ * stayed empty for the poll budget, at which point the pin interrupt is re-armed.
+ */
+
+// Run from the IRQ pin ISR in place of setting MCP2515_IRQ_FLAGGED.
+void can_napi_schedule()
+{
+	CAN_IRQ_PORTIE &= ~CAN_IRQ_PORTBIT;
+	mcp2515_napi_idle = 0;
+	mcp2515_napi_on = 1;
+}
+
+/* Read up to max frames, checking both RXBs with one RX STATUS per pass.  Returns the # of frames
+ * read.  After MCP2515_NAPI_BUDGET (see can_napi_budget()) empty polls in a row the IRQ pin interrupt
+ * is re-armed and polling stops.  If the IRQ line is still asserted with nothing to receive, there are
+ * TX or error events pending and MCP2515_IRQ_FLAGGED is set in mcp2515_irq so the main loop runs
+ * can_irq_handler() as usual.
+ */
+int can_napi_poll(struct can_frame *frames, uint8_t max)
+{
+	uint8_t rxb, pending, got = 0;
+	uint8_t msginbuf[13];
+
+	if (!mcp2515_napi_on)
+		return 0;
+
+	can_lock();
+	while (got < max) {
+		pending = can_spi_query(MCP2515_SPI_RX_STATUS) >> 6;  // 1 = RXB0, 2 = RXB1, 3 = both
+		if (!pending)
+			break;
+
+		for (rxb=0; rxb < 2 && got < max; rxb++) {
+			if ( !(pending & (1 << rxb)) )
+				continue;
+			if (can_rx_fetch(rxb, msginbuf))
+				can_frame_parse(msginbuf, &frames[got++]);
+		}
+	}
+	can_unlock();
+
+	if (got) {
+		mcp2515_napi_idle = 0;
+		return got;
+	}
+
+	if ( !(CAN_IRQ_PORTIN & CAN_IRQ_PORTBIT) )
+		mcp2515_irq |= MCP2515_IRQ_FLAGGED;  // Not RX; leave it to can_irq_handler()
+
+	if (++mcp2515_napi_idle >= mcp2515_napi_budget) {
+		mcp2515_napi_on = 0;
+		CAN_IRQ_PORTIFG &= ~CAN_IRQ_PORTBIT;
+		CAN_IRQ_PORTIE |= CAN_IRQ_PORTBIT;
+		// A frame landing just before re-arming asserts the line without a new edge; catch it here
+		if ( !(CAN_IRQ_PORTIN & CAN_IRQ_PORTBIT) )
+			can_napi_schedule();
+	}
+	return 0;
+}
+
+// Nonzero while receive is being polled; don't enter a Low-Power mode then.
+uint8_t can_napi_active()
+{
+	return mcp2515_napi_on;
+}
+
+// # of empty polls in a row before the IRQ pin interrupt is re-armed.
+void can_napi_budget(uint16_t polls)
+{
+	mcp2515_napi_budget = polls ? polls : 1;
 }
 
 // Returns RXBID of first full buffer or -1 if nothing is waiting.
@@ -446,6 +1260,7 @@ int can_rx_setmask(uint8_t maskid, uint32_t msgmask, uint8_t is_ext)
 	if (maskid > 1)
 		return -1;
 	
+	can_lock();
 	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
 		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
 
@@ -462,6 +1277,7 @@ int can_rx_setmask(uint8_t maskid, uint32_t msgmask, uint8_t is_ext)
 
 	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
 		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
+	can_unlock();
 
 	return maskid;
 }
@@ -479,6 +1295,7 @@ int can_rx_setfilter(uint8_t rxb, uint8_t filtid, uint32_t msgid)
 	if (filtid > 5 || (filtid > 1 && rxb == 0))
 		return -1;
 	
+	can_lock();
 	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
 		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
 
@@ -495,17 +1312,72 @@ int can_rx_setfilter(uint8_t rxb, uint8_t filtid, uint32_t msgid)
 	
 	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
 		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
+	can_unlock();
 
 	return filtid;
 }
 
+/* Rewrite both masks and all six filters in a single configuration-mode window, keeping the time the
+ * controller is off the bus short and bounded: one mode switch, confirmed through CANSTAT, then three
+ * burst WRITEs (RXF0-RXF2, RXF3-RXF5, RXM0-RXM1).  mask[] and is_ext[] are per RXB, filter[] is RXF0-RXF5.
+ * Returns 0, or -1 if the controller never entered configuration mode (nothing is written then).
+ */
+int can_rx_setconfig(const uint32_t *mask, const uint8_t *is_ext, const uint32_t *filter)
+{
+	uint8_t regs[12], i, stat = 0;
+
+	can_lock();
+	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION ) {
+		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
+		// The switch waits out any frame in progress on the bus
+		for (i=0; i < 255; i++) {
+			can_r_reg(MCP2515_CANSTAT, &stat, 1);
+			if ( (stat & MCP2515_CANSTAT_OPMOD_MASK) == MCP2515_CANSTAT_OPMOD_CONFIGURATION )
+				break;
+		}
+		if (i == 255) {
+			can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
+			can_unlock();
+			return -1;
+		}
+	}
+
+	for (i=0; i < 6; i++) {
+		if (is_ext[i < 2 ? 0 : 1])
+			can_compose_msgid_ext(filter[i], regs + 4*(i % 3));
+		else
+			can_compose_msgid_std(filter[i], regs + 4*(i % 3));
+		if (i == 2)
+			can_w_reg(MCP2515_RXF0SIDH, regs, 12);
+	}
+	can_w_reg(MCP2515_RXF3SIDH, regs, 12);
+
+	for (i=0; i < 2; i++) {
+		if (is_ext[i]) {
+			can_compose_msgid_ext(mask[i], regs + 4*i);
+			regs[4*i+1] &= ~0x08;  // EXIDE is unimplemented in the MASK registers
+			mcp2515_exmask |= 1 << i;
+		} else {
+			can_compose_msgid_std(mask[i], regs + 4*i);
+			mcp2515_exmask &= ~(1 << i);
+		}
+	}
+	can_w_reg(MCP2515_RXM0SIDH, regs, 8);
+
+	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
+		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
+	can_unlock();
+
+	return 0;
+}
+
 // RX mode for the specified RXB.  See MCP2515_RXB0CTRL_MODE_* for details.
 int can_rx_mode(uint8_t rxb, uint8_t mode)
 {
 	if (rxb > 1)
 		return -1;
 
-	can_w_bit(MCP2515_RXB0CTRL + rxb*0x10, MCP2515_RXB0CTRL_RXM0 | MCP2515_RXB0CTRL_RXM0, mode);
+	can_w_bit(MCP2515_RXB0CTRL + rxb*0x10, MCP2515_RXB0CTRL_RXM1 | MCP2515_RXB0CTRL_RXM0, mode);
 
 	return 0;
 }
@@ -513,6 +1385,9 @@ int can_rx_mode(uint8_t rxb, uint8_t mode)
 // Miscellaneous option-setting goes here.
 int can_ioctl(uint8_t option, uint8_t val)
 {
+	int ret = 0;
+
+	can_lock();
 	switch (option) {
 		// Allows RXB0 to shove its contents over to RXB1 if a new RXB0 frame comes in.
 		case MCP2515_OPTION_ROLLOVER:
@@ -623,10 +1498,38 @@ int can_ioctl(uint8_t option, uint8_t val)
 				can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_WAKIE, 0);
 			break;
 
+		/* Signal RXB0/RXB1 full on the RX0BF/RX1BF pins instead of the IRQ pin.  Each pin gets its own
+		 * MCU port interrupt, so the receive path knows which buffer to read without a CANINTF read.
+		 * The user's ISR for CAN_RXBF_PORT* must set BIT0/BIT1 in mcp2515_rxbf.
+		 */
+		case MCP2515_OPTION_RXBF_PINS:
+			if (val) {
+				CAN_RXBF_PORTIE &= ~(CAN_RXBF_PORTBIT0 | CAN_RXBF_PORTBIT1);
+				CAN_RXBF_PORTDIR &= ~(CAN_RXBF_PORTBIT0 | CAN_RXBF_PORTBIT1);
+				CAN_RXBF_PORTREN |= CAN_RXBF_PORTBIT0 | CAN_RXBF_PORTBIT1;
+				CAN_RXBF_PORTOUT |= CAN_RXBF_PORTBIT0 | CAN_RXBF_PORTBIT1;
+				CAN_RXBF_PORTIES |= CAN_RXBF_PORTBIT0 | CAN_RXBF_PORTBIT1;
+				CAN_RXBF_PORTIFG &= ~(CAN_RXBF_PORTBIT0 | CAN_RXBF_PORTBIT1);
+				CAN_RXBF_PORTIE |= CAN_RXBF_PORTBIT0 | CAN_RXBF_PORTBIT1;
+				can_w_bit(MCP2515_BFPCTRL, 0x0F, MCP2515_BFPCTRL_B0BFM | MCP2515_BFPCTRL_B0BFE |
+						  MCP2515_BFPCTRL_B1BFM | MCP2515_BFPCTRL_B1BFE);
+				can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_RX0IE | MCP2515_CANINTE_RX1IE, 0);
+				mcp2515_flags |= MCP2515_FLAG_RXBF_PINS;
+			} else {
+				CAN_RXBF_PORTIE &= ~(CAN_RXBF_PORTBIT0 | CAN_RXBF_PORTBIT1);
+				can_w_bit(MCP2515_BFPCTRL, 0x0F, 0);
+				can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_RX0IE | MCP2515_CANINTE_RX1IE,
+						  MCP2515_CANINTE_RX0IE | MCP2515_CANINTE_RX1IE);
+				mcp2515_rxbf = 0x00;
+				mcp2515_flags &= ~MCP2515_FLAG_RXBF_PINS;
+			}
+			break;
+
 		default:
-			return -1;
+			ret = -1;
 	}
-	return 0;
+	can_unlock();
+	return ret;
 }
 
 // Report error counters; valid registers include MCP2515_TEC (TX error count) and MCP2515_REC (RX error count)
@@ -654,14 +1557,217 @@ int can_read_error(uint8_t reg)
  * be cleared by the user's firmware.
  */
 
-int can_irq_handler()
+#if defined(MCP2515_RX_CALLBACK) || defined(MCP2515_FILHIT_DISPATCH)
+#ifdef MCP2515_FILHIT_DISPATCH
+#define MCP2515_FILHIT_DROPPED 0xFF
+
+/* READ (rather than READ RX BUFFER) from RXBnCTRL so the FILHIT bits come along with the frame.  This
+ * does not clear RXnIF, unless the accept hook drops the frame.  Returns the acceptance filter# (0-5)
+ * that matched or MCP2515_FILHIT_DROPPED.
+ */
+static uint8_t can_rx_fetch_filhit(uint8_t rxb, uint8_t *img)
+{
+	uint8_t i, len, ctrl;
+
+#ifdef MCP2515_FRAME_TIMESTAMP
+	can_rx_ts(rxb, 0);  // The frame may yet be left for can_recv()
+#endif
+	CAN_CS_LOW;
+	spi_transfer(MCP2515_SPI_READ);
+	spi_transfer(MCP2515_RXB0CTRL + 0x10*rxb);
+	ctrl = spi_transfer(0xFF);
+	for (i=0; i < 5; i++)
+		img[i] = spi_transfer(0xFF);
+#ifdef MCP2515_RX_ACCEPT_HOOK
+	if (mcp2515_rx_accept && !mcp2515_rx_accept(img)) {
+		CAN_CS_HIGH;
+#ifdef MCP2515_FRAME_TIMESTAMP
+		can_rx_ts(rxb, 1);
+#endif
+#ifdef MCP2515_BUSLOAD
+		can_busload_add(can_busload_bits(img, 0));
+#endif
+		can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_RX0IF << rxb, 0);
+		return MCP2515_FILHIT_DROPPED;
+	}
+#endif
+	len = img[4] & 0x0F;
+	if (len > 8)
+		len = 8;
+	for (i=0; i < len; i++)
+		img[5+i] = spi_transfer(0xFF);
+	CAN_CS_HIGH;
+
+	if (rxb)
+		return ctrl & (MCP2515_RXB1CTRL_FILHIT2 | MCP2515_RXB1CTRL_FILHIT1 | MCP2515_RXB1CTRL_FILHIT0);
+	return ctrl & MCP2515_RXB0CTRL_FILHIT0;
+}
+#endif
+
+/* Deliver full RXBs to the handler bound to the acceptance filter that matched, falling back to the
+ * can_rx_callback() handler.  Returns ifg with the RX flags of delivered frames removed.
+ */
+static uint8_t can_rx_service(uint8_t ifg)
+{
+	uint8_t rxb, rxif;
+	can_rx_callback_t h;
+#ifdef MCP2515_FILHIT_DISPATCH
+	uint8_t filhit;
+#endif
+
+	for (rxb=0; rxb < 2; rxb++) {
+		rxif = MCP2515_CANINTF_RX0IF << rxb;
+		if ( !(ifg & rxif) )
+			continue;
+		h = 0;
+#ifdef MCP2515_FILHIT_DISPATCH
+		if (mcp2515_filhit_bound) {
+			filhit = can_rx_fetch_filhit(rxb, mcp2515_rximg);
+			if (filhit == MCP2515_FILHIT_DROPPED) {
+				ifg &= ~rxif;
+				continue;
+			}
+			h = mcp2515_filhit[filhit];
+#ifdef MCP2515_RX_CALLBACK
+			if (!h)
+				h = mcp2515_rx_cb;
+#endif
+			if (!h)
+				continue;  // Unbound filter; leave it for can_recv()
+#ifdef MCP2515_FRAME_TIMESTAMP
+			can_rx_ts(rxb, 1);
+#endif
+#ifdef MCP2515_BUSLOAD
+			can_busload_add(can_busload_bits(mcp2515_rximg, mcp2515_rximg+5));
+#endif
+			can_w_bit(MCP2515_CANINTF, rxif, 0);
+		}
+#endif
+#ifdef MCP2515_RX_CALLBACK
+		if (!h) {
+			if ( !(h = mcp2515_rx_cb) )
+				continue;
+			if (!can_rx_fetch(rxb, mcp2515_rximg)) {
+				ifg &= ~rxif;
+				continue;
+			}
+		}
+#endif
+		mcp2515_buf = rxb;
+		h(rxb, mcp2515_rximg);
+		ifg &= ~rxif;
+	}
+	return ifg;
+}
+#endif
+
+#ifdef MCP2515_RTR_RESPONDER
+/* Peek at RXBnCTRL of each full RXB without consuming it, and at the ID only if it holds a remote frame.
+ * Remote frames matching a responder entry are answered and their RXnIF cleared; everything else is left
+ * for the regular receive path, and so is a match whose reply found every TXB busy.  Returns the CANINTF
+ * RX flags that were answered.
+ */
+static uint8_t can_rtr_service(uint8_t ifg)
+{
+	uint8_t rxb, i, hdr[6], answered = 0;
+	struct can_rtr_responder *r;
+	struct can_frame f;
+
+	for (rxb=0; rxb < 2; rxb++) {
+		if ( !(ifg & (MCP2515_CANINTF_RX0IF << rxb)) )
+			continue;
+		can_r_reg(MCP2515_RXB0CTRL + 0x10*rxb, hdr, 1);
+		if ( !(hdr[0] & MCP2515_RXB0CTRL_RXRTR) )
+			continue;
+		can_r_reg(MCP2515_RXB0SIDH + 0x10*rxb, hdr+1, 5);  // ID and DLC, only for remote frames
+
+		for (i=0, r=mcp2515_rtr; i < mcp2515_rtr_count; i++, r++) {
+			// SIDL bit 4 is SRR and bit 2 is unimplemented; EID bytes only count for Extended frames
+			if (hdr[1] != r->idbuf[0] || ((hdr[2] ^ r->idbuf[1]) & 0xEB))
+				continue;
+			if ( (hdr[2] & 0x08) && (hdr[3] != r->idbuf[2] || hdr[4] != r->idbuf[3]) )
+				continue;
+
+			if (r->txb < 3 && (mcp2515_txrsv & (1 << r->txb))) {
+				can_tx_fire(1 << r->txb);
+			} else {
+				f.id = r->id;
+				f.flags = r->flags & CAN_FRAME_EXT;
+				f.prio = 3;
+				if (r->fill) {
+					f.dlc = r->fill(f.data);
+				} else {
+					f.dlc = r->dlc;
+					memcpy(f.data, r->data, r->dlc);
+				}
+				if (can_frame_send(&f) < 0) {
+					if (mcp2515_rtr_missed != 0xFFFF)
+						mcp2515_rtr_missed++;
+					break;  // Hand the request to the application rather than lose it
+				}
+			}
+#ifdef MCP2515_FRAME_TIMESTAMP
+			can_rx_ts(rxb, 1);
+#endif
+#ifdef MCP2515_BUSLOAD
+			can_busload_add(can_busload_bits(hdr+1, hdr+1));  // Remote frames carry no data
+#endif
+			can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_RX0IF << rxb, 0);
+			answered |= MCP2515_CANINTF_RX0IF << rxb;
+			break;
+		}
+	}
+	return answered;
+}
+#endif
+
+static int can_irq_service()
 {
 	int i;
 	uint8_t ifg, eflg, ie, txbctrl;
+#if defined(MCP2515_FRAME_TIMESTAMP) || defined(MCP2515_TX_LATENCY)
+	uint32_t seen = can_timer_now();
+#endif
+#ifdef MCP2515_FRAME_TIMESTAMP
+	uint16_t sr;
+#endif
+#if defined(MCP2515_FRAME_TIMESTAMP) && defined(MCP2515_TX_LATENCY)
+	uint32_t edge = seen;
+	uint8_t edged = 0;
+#endif
 
 	mcp2515_irq &= MCP2515_IRQ_FLAGGED;  // Clear everything but the flagged bit.
 	// Read CANINTF to get started
 	can_r_reg(MCP2515_CANINTF, &ifg, 1);
+	// Full RXBs are signalled on the RXnBF pins instead and left for can_frame_recv_rxb()
+	if (mcp2515_flags & MCP2515_FLAG_RXBF_PINS)
+		ifg &= ~(MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF);
+#ifdef MCP2515_FRAME_TIMESTAMP
+	// An IRQ edge from before this read with no RX behind it was a TX/error/wakeup event; keep its time
+	if ( !(ifg & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF)) ) {
+		sr = __get_interrupt_state();
+		_DINT();
+		if ( (mcp2515_rxts_set & MCP2515_RXTS_EDGE) && (int32_t)(seen - mcp2515_edgets) >= 0 ) {
+#ifdef MCP2515_TX_LATENCY
+			edge = mcp2515_edgets;
+			edged = 1;
+#endif
+			mcp2515_rxts_set &= ~MCP2515_RXTS_EDGE;
+		}
+		__set_interrupt_state(sr);
+	}
+#endif
+
+#ifdef MCP2515_RTR_RESPONDER
+	// Answer remote frames from the responder table before anything else sees them
+	if ( (ifg & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF)) && mcp2515_rtr_count ) {
+		ifg &= ~can_rtr_service(ifg);
+		if ( !(ifg & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF)) ) {
+			mcp2515_irq |= MCP2515_IRQ_RX | MCP2515_IRQ_HANDLED;
+			return MCP2515_IRQ_RX | MCP2515_IRQ_HANDLED;
+		}
+	}
+#endif
 
 	// RX success IRQ?
 	if (ifg & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF)) {
@@ -669,6 +1775,15 @@ int can_irq_handler()
 			mcp2515_buf = 0;
 		else
 			mcp2515_buf = 1;
+#if defined(MCP2515_RX_CALLBACK) || defined(MCP2515_FILHIT_DISPATCH)
+		// Hand what we can straight to registered handlers; the rest is left for can_recv()
+		ifg = can_rx_service(ifg);
+		if ( !(ifg & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF)) ) {
+			mcp2515_irq |= MCP2515_IRQ_RX | MCP2515_IRQ_HANDLED;
+			return MCP2515_IRQ_RX | MCP2515_IRQ_HANDLED;
+		}
+		mcp2515_buf = (ifg & MCP2515_CANINTF_RX0IF) ? 0 : 1;
+#endif
 		mcp2515_irq |= MCP2515_IRQ_RX;
 		return MCP2515_IRQ_RX;
 	}
@@ -678,8 +1793,36 @@ int can_irq_handler()
 		for (i=0; i <= 2; i++) {
 			if (ifg & (MCP2515_CANINTF_TX0IF << i)) {
 				can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_TX0IF << i, 0);  // Clear IFG
-				can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << i, 0);  // Disable interrupt (will be re-enabled on next TX)
-				mcp2515_txb &= ~(1 << i);
+#ifdef MCP2515_TX_LATENCY
+#ifdef MCP2515_FRAME_TIMESTAMP
+				/* An IRQ edge that came in after the frame was requested is when TXnIF really went up.
+				 * Without one (an RX claimed it, or it predates the request) only our own time is left.
+				 */
+				if ( edged && (int32_t)(edge - mcp2515_txq[i]) >= 0 ) {
+					mcp2515_txedge |= (1 << i) & mcp2515_txtimed;
+					can_tx_done(1 << i, edge);
+				} else {
+					can_tx_done(1 << i, seen);
+				}
+#else
+				can_tx_done(1 << i, seen);
+#endif
+#endif
+#ifdef MCP2515_BUSLOAD
+				can_tx_busload(1 << i);
+#endif
+				// Reserved TXBs stay loaded and armed for their next trigger
+				if ( !(mcp2515_txrsv & (1 << i)) ) {
+					can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << i, 0);  // Disable interrupt (will be re-enabled on next TX)
+					mcp2515_txb &= ~(1 << i);
+#ifdef MCP2515_TX_FREE_HOOK
+					if (mcp2515_tx_free)
+						mcp2515_tx_free(i);
+#endif
+				} else if (mcp2515_txreload[i]) {
+					can_tx_load_frame(i, mcp2515_txreload[i]);
+					mcp2515_txreload[i] = 0;
+				}
 				mcp2515_buf = i;
 				mcp2515_irq |= MCP2515_IRQ_TX | MCP2515_IRQ_HANDLED;
 				return MCP2515_IRQ_TX | MCP2515_IRQ_HANDLED;
@@ -706,8 +1849,14 @@ int can_irq_handler()
 					can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_MERRF, 0);  // Clear MERRF
 					// Are we in OneShot mode?
 					if (mcp2515_ctrl & MCP2515_CANCTRL_OSM) {
-						can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << i, 0);  // Disable interrupt (will be re-enabled on next TX)
-						mcp2515_txb &= ~(1 << i);
+						if ( !(mcp2515_txrsv & (1 << i)) ) {
+							can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << i, 0);  // Disable interrupt (will be re-enabled on next TX)
+							mcp2515_txb &= ~(1 << i);
+#ifdef MCP2515_TX_FREE_HOOK
+							if (mcp2515_tx_free)
+								mcp2515_tx_free(i);
+#endif
+						}
 						mcp2515_irq |= MCP2515_IRQ_TX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
 						return MCP2515_IRQ_TX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
 					} else {
@@ -755,17 +1904,139 @@ int can_irq_handler()
 	return 0;
 }
 
+int can_irq_handler()
+{
+	int irq;
+
+	can_lock();
+	irq = can_irq_service();
+	can_unlock();
+	return irq;
+}
+
+// Most can_irq_handler() passes per can_irq_isr() call before handing over to the main loop
+#define MCP2515_IRQ_ISR_PASSES 8
+
+/* Run from the IRQ pin ISR in place of setting MCP2515_IRQ_FLAGGED, so receive handlers and TX completion
+ * are serviced in interrupt context.  Events can_irq_handler() doesn't handle by itself are left for the
+ * main loop with MCP2515_IRQ_FLAGGED set.  If the main loop has the driver locked, this runs again from its
+ * can_unlock().  Returns nonzero if the CPU should be woken on exit from the ISR.
+ */
+uint8_t can_irq_isr()
+{
+	uint8_t pass;
+	int irq = 0;
+
+	if (!can_lock_isr(can_irq_isr))
+		return 0;
+	mcp2515_irq |= MCP2515_IRQ_FLAGGED;
+	for (pass=0; pass < MCP2515_IRQ_ISR_PASSES; pass++) {
+		irq = can_irq_service();
+		if ( !irq || !(irq & MCP2515_IRQ_HANDLED) || (irq & (MCP2515_IRQ_ERROR | MCP2515_IRQ_WAKEUP)) )
+			break;
+	}
+	can_unlock();
+	return irq != 0;
+}
+
+#ifdef MCP2515_RX_CALLBACK
+/* Register a zero-copy receive handler (0 to go back to can_recv()).  Once registered, can_irq_handler()
+ * reads each full RXB into a driver-owned image and calls the handler with it, so the handler runs in
+ * whatever context can_irq_handler() is run from -- including the IRQ pin's ISR, by way of can_irq_isr().
+ */
+void can_rx_callback(can_rx_callback_t cb)
+{
+	mcp2515_rx_cb = cb;
+}
+#endif
+
+#ifdef MCP2515_RTR_RESPONDER
+/* Register a table of remote frame responders (count = 0 to disable).  The table stays owned by the
+ * caller and must remain valid; each entry's message ID is pre-composed into register layout here so
+ * matching in the IRQ path is a byte compare.
+ */
+void can_rtr_responders(struct can_rtr_responder *table, uint8_t count)
+{
+	uint8_t i;
+
+	for (i=0; i < count; i++) {
+		if (table[i].flags & CAN_FRAME_EXT)
+			can_compose_msgid_ext(table[i].id, table[i].idbuf);
+		else
+			can_compose_msgid_std(table[i].id, table[i].idbuf);
+		if (table[i].dlc > 8)
+			table[i].dlc = 8;
+	}
+	mcp2515_rtr_count = 0;
+	mcp2515_rtr = table;
+	mcp2515_rtr_count = count;
+}
+
+// # of matching remote frames passed on unanswered because no TXB was free; reset != 0 clears it.
+uint16_t can_rtr_missed(uint8_t reset)
+{
+	uint16_t n = mcp2515_rtr_missed;
+
+	if (reset)
+		mcp2515_rtr_missed = 0;
+	return n;
+}
+#endif
+
+#ifdef MCP2515_FILHIT_DISPATCH
+/* Bind a receive handler to acceptance filter filhit (0-5, i.e. RXF0-RXF5; the value can_rx_setfilter()
+ * returns), or unbind it with 0.  can_irq_handler() then sends frames accepted by that filter straight
+ * to the handler using the FILHIT bits in RXBnCTRL, with no ID parsing or comparisons.  Frames accepted by
+ * unbound filters go to the can_rx_callback() handler if there is one, else they're left for can_recv().
+ */
+int can_rx_bind(uint8_t filhit, can_rx_callback_t h)
+{
+	if (filhit > 5)
+		return -1;
+
+	mcp2515_filhit_bound &= ~(1 << filhit);
+	mcp2515_filhit[filhit] = h;
+	if (h)
+		mcp2515_filhit_bound |= 1 << filhit;
+	return filhit;
+}
+#endif
+
+#ifdef MCP2515_RX_ACCEPT_HOOK
+/* Register a second-stage acceptance test (0 to remove it).  Every RX path in the driver -- can_recv(),
+ * the batch and raw readers and the can_irq_handler() callbacks -- runs it on the frame header before
+ * reading any data, and drops the frame if it returns 0.  Dropped frames still free their RXB.
+ */
+void can_rx_accept(can_rx_accept_t fn)
+{
+	mcp2515_rx_accept = fn;
+}
+#endif
+
+#ifdef MCP2515_TX_FREE_HOOK
+/* Register a function to run whenever a TXB frees up (0 to remove it), so queued work can be handed a
+ * buffer the moment there is one instead of waiting to be polled again.
+ */
+void can_tx_free_hook(can_tx_free_t fn)
+{
+	mcp2515_tx_free = fn;
+}
+#endif
+
 int can_clear_buserror()
 {
 	uint8_t intf, eflg;
+	int ret = -1;  // No bus error found
 
+	can_lock();
 	can_r_reg(MCP2515_CANINTF, &intf, 1);
 	if (intf & MCP2515_CANINTF_ERRIF) {
 		can_r_reg(MCP2515_EFLG, &eflg, 1);
 		can_w_bit(MCP2515_EFLG, MCP2515_EFLG_RX0OVR | MCP2515_EFLG_RX1OVR, 0);  // The only bits that can be written
 		can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_ERRIF, 0);
-		return eflg;
+		ret = eflg;
 	}
+	can_unlock();
 
-	return -1;  // No bus error found
+	return ret;
 }
@@ -38,10 +38,55 @@
 #define CAN_IRQ_PORTIES P1IES
 #define CAN_IRQ_PORTIE P1IE
 #define CAN_IRQ_PORTIFG P1IFG
+#define CAN_IRQ_PORTIN P1IN
+
+// RX0BF/RX1BF buffer-full pins, only used with can_ioctl(MCP2515_OPTION_RXBF_PINS, 1)
+#define CAN_RXBF_PORTBIT0 BIT1
+#define CAN_RXBF_PORTBIT1 BIT2
+#define CAN_RXBF_PORTOUT P2OUT
+#define CAN_RXBF_PORTDIR P2DIR
+#define CAN_RXBF_PORTREN P2REN
+#define CAN_RXBF_PORTIES P2IES
+#define CAN_RXBF_PORTIE P2IE
+#define CAN_RXBF_PORTIFG P2IFG
 
 // BoosterPack contains 16MHz crystal w/ 22pF load caps
 #define CAN_OSC_FREQUENCY 16000000
 
+// Empty RX STATUS polls before can_napi_poll() hands receive back to the IRQ pin
+#define MCP2515_NAPI_BUDGET 32
+
+// ISR jobs (can_irq_isr(), can_coalesce_irq(), can_sched.c) that can wait at once for the main loop to unlock the driver
+#define MCP2515_DEFER_SLOTS 4
+
+// RAM of the target part in bytes; optional modules (can_pool.c, can_filtsolve.c) size their static buffers from it
+#if defined(__MSP430G2231__) || defined(__MSP430G2211__) || defined(__MSP430G2201__)
+#define MCP2515_RAM_SIZE 128
+#elif defined(__MSP430G2452__) || defined(__MSP430G2412__)
+#define MCP2515_RAM_SIZE 256
+#elif defined(__MSP430G2553__) || defined(__MSP430G2533__) || defined(__MSP430G2513__)
+#define MCP2515_RAM_SIZE 512
+#elif defined(__MSP430FR5969__) || defined(__MSP430F5172__)
+#define MCP2515_RAM_SIZE 2048
+#elif defined(__MSP430F5529__)
+#define MCP2515_RAM_SIZE 8192
+#endif
+#ifndef MCP2515_RAM_SIZE
+#define MCP2515_RAM_SIZE 512  // Unknown part; assume a G2553
+#endif
+
+/* Optional driver features; each costs RAM on the receive/transmit path, so they're off by default */
+//#define MCP2515_RX_CALLBACK 1  // can_rx_callback(): zero-copy receive serviced from can_irq_handler()
+//#define MCP2515_FRAME_TIMESTAMP 1  // Receive timestamps from can_rx_stamp() in struct can_frame; needs can_timer.c
+//#define MCP2515_RTR_RESPONDER 1  // can_rtr_responders(): answer remote frames from can_irq_handler()
+//#define MCP2515_FILHIT_DISPATCH 1  // can_rx_bind(): per-acceptance-filter receive handlers
+//#define MCP2515_RX_ACCEPT_HOOK 1  // can_rx_accept(): second-stage software filter, e.g. can_swfilter.c
+//#define MCP2515_BUSLOAD 1  // Count every frame received or sent in can_busload.c; needs can_framelen.c and can_timer.c
+//#define MCP2515_TX_LATENCY 1  // can_tx_latency(): enqueue-to-TXnIF histograms per TX priority; needs can_timer.c
+//#define MCP2515_TX_FREE_HOOK 1  // can_tx_free_hook(): run a function from can_irq_handler() as each TXB frees up, e.g. can_sched.c
+// Log2 buckets per priority for MCP2515_TX_LATENCY: bucket 0 is 0 ticks, bucket n is 2^(n-1) to 2^n-1, the last is open-ended
+#define MCP2515_TXLAT_BUCKETS 16
+
 /* Register Memory Map */
 #define MCP2515_RXF0SIDH 0x00
 #define MCP2515_RXF0SIDL 0x01
@@ -321,6 +366,16 @@
 #define MCP2515_SPI_RX_STATUS   0xB0
 #define MCP2515_SPI_BITMOD      0x05
 
+/* Bits returned by the READ STATUS instruction */
+#define MCP2515_STATUS_RX0IF  0x01
+#define MCP2515_STATUS_RX1IF  0x02
+#define MCP2515_STATUS_TX0REQ 0x04
+#define MCP2515_STATUS_TX0IF  0x08
+#define MCP2515_STATUS_TX1REQ 0x10
+#define MCP2515_STATUS_TX1IF  0x20
+#define MCP2515_STATUS_TX2REQ 0x40
+#define MCP2515_STATUS_TX2IF  0x80
+
 /* bufid's for can_r_rxbuf() / can_w_txbuf() */
 #define MCP2515_RXBUF_RXB0SIDH 0x00
 #define MCP2515_RXBUF_RXB0D0 0x02
@@ -346,6 +401,7 @@
 #define MCP2515_OPTION_SOFOUT 9
 #define MCP2515_OPTION_WAKE_GLITCH_FILTER 10
 #define MCP2515_OPTION_WAKE 11
+#define MCP2515_OPTION_RXBF_PINS 12
 
 /* IRQ handling */
 #define MCP2515_IRQ_FLAGGED 0x80
@@ -355,10 +411,145 @@
 #define MCP2515_IRQ_ERROR 0x04
 #define MCP2515_IRQ_WAKEUP 0x08
 
+/* Compile-time bit timing for CAN_OSC_FREQUENCY
+ * CAN_BT_CNF(bitrate) expands to a { CNF1, CNF2, CNF3 } initializer worked out entirely by the compiler:
+ * the first of 16, 8, 10, 12, 14, 18, 9, 11, 13, 15, 17 TQ per bit that divides the oscillator exactly,
+ * with the sample point as near 87.5% as the MCP2515 allows and SJW as wide as PS1/PS2 permit.  Bitrates the
+ * oscillator can't produce exactly come out as { 0, 0, 0 }.  can_speed_fast() uses a table of these for the
+ * CAN_SPEED_* bitrates; more can be built the same way for can_speed_cnf().
+ */
+#define CAN_BT_FITS(br, n) (CAN_OSC_FREQUENCY % (2UL * (n) * (br)) == 0 && CAN_OSC_FREQUENCY / (2UL * (n) * (br)) <= 64)
+#define CAN_BT_NTQ(br) (CAN_BT_FITS(br, 16) ? 16 : CAN_BT_FITS(br, 8) ? 8 : CAN_BT_FITS(br, 10) ? 10 : \
+			CAN_BT_FITS(br, 12) ? 12 : CAN_BT_FITS(br, 14) ? 14 : CAN_BT_FITS(br, 18) ? 18 : \
+			CAN_BT_FITS(br, 9) ? 9 : CAN_BT_FITS(br, 11) ? 11 : CAN_BT_FITS(br, 13) ? 13 : \
+			CAN_BT_FITS(br, 15) ? 15 : CAN_BT_FITS(br, 17) ? 17 : 0)
+#define CAN_BT_BRP(br) (CAN_BT_NTQ(br) ? CAN_OSC_FREQUENCY / (2UL * CAN_BT_NTQ(br) * (br)) : 1)
+#define CAN_BT_PS2(br) ((CAN_BT_NTQ(br) - (CAN_BT_NTQ(br) * 7 + 4) / 8) < 2 ? 2 : (CAN_BT_NTQ(br) - (CAN_BT_NTQ(br) * 7 + 4) / 8))
+#define CAN_BT_TSEG1(br) (CAN_BT_NTQ(br) - 1 - CAN_BT_PS2(br))
+#define CAN_BT_PROP(br) (CAN_BT_TSEG1(br) / 2)
+#define CAN_BT_PS1(br) (CAN_BT_TSEG1(br) - CAN_BT_PROP(br))
+#define CAN_BT_SJW(br) (CAN_BT_PS2(br) - 1 > 4 ? 4 : CAN_BT_PS2(br) - 1)
+#define CAN_BT_CNF(br) { \
+	CAN_BT_NTQ(br) ? (uint8_t)(((CAN_BT_SJW(br) - 1) << 6) | (CAN_BT_BRP(br) - 1)) : 0, \
+	CAN_BT_NTQ(br) ? (uint8_t)(MCP2515_CNF2_BTLMODE | ((CAN_BT_PS1(br) - 1) << 3) | (CAN_BT_PROP(br) - 1)) : 0, \
+	CAN_BT_NTQ(br) ? (uint8_t)(CAN_BT_PS2(br) - 1) : 0 }
+
+/* can_speed_fast() bitrates */
+#define CAN_SPEED_1M 0
+#define CAN_SPEED_800K 1
+#define CAN_SPEED_500K 2
+#define CAN_SPEED_250K 3
+#define CAN_SPEED_125K 4
+#define CAN_SPEED_100K 5
+#define CAN_SPEED_50K 6
+#define CAN_SPEED_20K 7
+#define CAN_SPEED_10K 8
+#define CAN_SPEED_COUNT 9
+
+/* One CAN frame, used by can_frame_send() / can_frame_recv() and the batch functions */
+#define CAN_FRAME_EXT 0x01
+#define CAN_FRAME_RTR 0x02
+
+struct can_frame {
+	uint32_t id;
+	uint8_t flags;    // CAN_FRAME_EXT, CAN_FRAME_RTR
+	uint8_t dlc;      // 0-8
+	uint8_t prio;     // TX priority 0-3, ignored on receive
+	uint8_t data[8];
+#ifdef MCP2515_FRAME_TIMESTAMP
+	uint32_t ts;      // Receive timestamp
+#endif
+};
+
+/* Raw frame in MCP2515 register layout, for pass-through paths (gateways, loggers, replay)
+ * which have no need to convert the message ID to or from a uint32_t.
+ */
+struct can_raw_frame {
+	uint8_t sidh;
+	uint8_t sidl;
+	uint8_t eid8;
+	uint8_t eid0;
+	uint8_t dlc;
+	uint8_t data[8];
+};
+
+#define CAN_RAW_IS_EXT(f) ((f)->sidl & 0x08)
+#define CAN_RAW_IS_RTR(f) (CAN_RAW_IS_EXT(f) ? ((f)->dlc & 0x40) : ((f)->sidl & 0x10))
+#define CAN_RAW_DLC(f) ((f)->dlc & 0x0F)
+// Standard ID using 16-bit math only; not meaningful for Extended frames
+#define CAN_RAW_STDID(f) ( ((uint16_t)(f)->sidh << 3) | ((f)->sidl >> 5) )
+#define CAN_RAW_SET_STDID(f, id) do { (f)->sidh = (uint8_t)((id) >> 3); (f)->sidl = (uint8_t)((id) << 5); \
+                                      (f)->eid8 = 0; (f)->eid0 = 0; } while (0)
+#define CAN_RAW_SAME_ID(a, b) ((a)->sidh == (b)->sidh && (a)->sidl == (b)->sidl && \
+                               (a)->eid8 == (b)->eid8 && (a)->eid0 == (b)->eid0)
+#define CAN_RAW_ID(f) can_parse_msgid((uint8_t *)(f))
+
+/* Zero-copy receive (MCP2515_RX_CALLBACK, MCP2515_FILHIT_DISPATCH)
+ * The handler gets the RXB# and a pointer to the driver-owned 13-byte RXB image laid out
+ * as SIDH, SIDL, EID8, EID0, DLC, D0-D7.  The image is only valid until the handler returns.
+ * Use the CAN_RXIMG_* macros to look at it; the message ID is only decoded if asked for.
+ */
+typedef void (*can_rx_callback_t)(uint8_t rxb, uint8_t *rximg);
+
+#define CAN_RXIMG_IS_EXT(img) ((img)[1] & 0x08)
+#define CAN_RXIMG_IS_RTR(img) (CAN_RXIMG_IS_EXT(img) ? ((img)[4] & 0x40) : ((img)[1] & 0x10))
+#define CAN_RXIMG_DLC(img) ((img)[4] & 0x0F)
+#define CAN_RXIMG_DATA(img) ((img) + 5)
+#define CAN_RXIMG_ID(img) can_parse_msgid(img)
+
+/* Second-stage acceptance test (MCP2515_RX_ACCEPT_HOOK)
+ * Called with the 5 header bytes (SIDH, SIDL, EID8, EID0, DLC) of every frame the driver reads, while the
+ * data bytes are still in the RXB.  Returning 0 drops the frame; no data is read and nothing is delivered.
+ */
+typedef uint8_t (*can_rx_accept_t)(const uint8_t *hdr);
+
+/* TX buffer freed (MCP2515_TX_FREE_HOOK)
+ * Called from can_irq_handler(), with the driver lock held, once TXB txb has finished (or, in one-shot mode,
+ * failed) its frame and can_send() may use it again.  It may send straight away.
+ */
+typedef void (*can_tx_free_t)(uint8_t txb);
+
+/* Remote frame auto-responder (MCP2515_RTR_RESPONDER)
+ * can_irq_handler() answers a remote frame whose ID matches an entry by firing the entry's template TXB
+ * (see can_tx_template()) or, when txb is CAN_RTR_NO_TXB, sending data/dlc or what fill() puts in buf
+ * (fill returns the DLC) on the next free TXB at priority 3.
+ */
+#define CAN_RTR_NO_TXB 0xFF
+
+struct can_rtr_responder {
+	uint32_t id;
+	uint8_t flags;                  // CAN_FRAME_EXT
+	uint8_t txb;                    // Template TXB# or CAN_RTR_NO_TXB
+	uint8_t dlc;
+	const uint8_t *data;
+	uint8_t (*fill)(uint8_t *buf);  // Overrides data/dlc if set
+	uint8_t idbuf[4];               // Filled in by can_rtr_responders()
+};
+
+/* Driver lock
+ * ISRs that talk to the MCP2515 (can_irq_isr(), can_coalesce_irq(), the can_sched.c timer) must not cut into an SPI
+ * transaction, or a multi-step driver call, from the main loop.  Every driver call holds the lock while it runs.  An
+ * ISR that finds the lock taken leaves its job to the can_unlock() that releases it, which runs the job with
+ * interrupts off, just as the ISR would have.  A job returns nonzero if it wants the CPU woken (ignored when deferred).
+ */
+typedef uint8_t (*can_deferred_t)(void);
+
 /* Global variable used for IRQ handling */
 extern volatile uint8_t mcp2515_irq, mcp2515_buf;
+// Bitrate set by the last can_speed*() or can_rebitrate() call, 0 if none yet
+extern uint32_t mcp2515_bitrate;
+// Set BIT0/BIT1 from the RX0BF/RX1BF pin ISR when MCP2515_OPTION_RXBF_PINS is active
+extern volatile uint8_t mcp2515_rxbf;
+
+#ifdef MCP2515_FRAME_TIMESTAMP
+// can_rx_stamp() argument from the IRQ pin ISR; BIT0/BIT1 stamp RXB0/RXB1 from their RXnBF pin ISRs
+#define MCP2515_RXTS_EDGE 0x80
+#endif
 
 /* Function prototypes */
+void can_lock();
+void can_unlock();
+uint8_t can_lock_isr(can_deferred_t);
 void can_spi_command(uint8_t);
 uint8_t can_spi_query(uint8_t);
 void can_r_reg(uint8_t, void *, uint8_t);
@@ -369,22 +560,67 @@ void can_r_rxbuf(uint8_t, void *, uint8_t);
 
 void can_init();
 int can_speed(uint32_t, uint8_t, uint8_t);
+int can_speed_cnf(const uint8_t *, uint32_t);
+void can_cnf_write(const uint8_t *, uint32_t);
+int can_speed_fast(uint8_t);
 void can_compose_msgid_std(uint32_t, uint8_t *);
 void can_compose_msgid_ext(uint32_t, uint8_t *);
 uint32_t can_parse_msgid(uint8_t *);
 
+int can_frame_send(const struct can_frame *);
+int can_frame_recv(struct can_frame *);
+int can_frame_recv_rxb(uint8_t, struct can_frame *);
 int can_send(uint32_t, uint8_t, void *, uint8_t, uint8_t);
+int can_send_batch(struct can_frame *, uint8_t);
+int can_send_raw(const struct can_raw_frame *, uint8_t);
 int can_query(uint32_t, uint8_t, uint8_t);
 int can_tx_cancel();
 int can_tx_available();
+int can_tx_pin_mode(uint8_t);
+int can_tx_preload(uint8_t, const struct can_frame *);
+int can_tx_template(uint8_t, const struct can_frame *);
+void can_tx_fire(uint8_t);
+void can_tx_release(uint8_t);
 int can_recv(uint32_t *, uint8_t *, void *);
+int can_recv_batch(struct can_frame *, uint8_t);
+int can_recv_raw(struct can_raw_frame *);
+void can_napi_schedule();
+int can_napi_poll(struct can_frame *, uint8_t);
+uint8_t can_napi_active();
+void can_napi_budget(uint16_t);
 int can_rx_pending();
 int can_rx_setmask(uint8_t, uint32_t, uint8_t);
 int can_rx_setfilter(uint8_t, uint8_t, uint32_t);
+int can_rx_setconfig(const uint32_t *, const uint8_t *, const uint32_t *);
 int can_rx_mode(uint8_t, uint8_t);
 int can_ioctl(uint8_t, uint8_t);
 int can_read_error(uint8_t);
 int can_irq_handler();
+uint8_t can_irq_isr();
+#ifdef MCP2515_RX_CALLBACK
+void can_rx_callback(can_rx_callback_t);
+#endif
+#ifdef MCP2515_RTR_RESPONDER
+void can_rtr_responders(struct can_rtr_responder *, uint8_t);
+uint16_t can_rtr_missed(uint8_t);
+#endif
+#ifdef MCP2515_FILHIT_DISPATCH
+int can_rx_bind(uint8_t, can_rx_callback_t);
+#endif
+#ifdef MCP2515_RX_ACCEPT_HOOK
+void can_rx_accept(can_rx_accept_t);
+#endif
+#ifdef MCP2515_TX_FREE_HOOK
+void can_tx_free_hook(can_tx_free_t);
+#endif
+#ifdef MCP2515_FRAME_TIMESTAMP
+void can_rx_stamp(uint8_t);
+uint32_t can_rx_lastts();
+#endif
+#ifdef MCP2515_TX_LATENCY
+int can_tx_times(uint8_t, uint32_t *, uint32_t *);
+int can_tx_latency(uint8_t, uint16_t *, uint8_t);
+#endif
 int can_clear_buserror();
 
 
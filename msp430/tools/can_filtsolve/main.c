@@ -0,0 +1,126 @@
+/* can_filtsolve - host tool
+ * Computes MCP2515 acceptance masks and filters for a list of wanted message IDs and prints them
+ * as can_rx_setmask()/can_rx_setfilter() calls.
+ * 
+ * Input (a file or stdin), one ID per line, # starts a comment:
+ *   W <id> [x]          wanted ID; x marks an Extended ID
+ *   O <id> [x] [rate]   other (unwanted) traffic seen on the bus, with its rate in frames/sec
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "can_filtsolve.h"
+
+#define MAX_LINES 4096
+
+static struct can_filt_id want[MAX_LINES], others[MAX_LINES];
+
+int main(int argc, char *argv[])
+{
+	FILE *in = stdin;
+	char line[256], *tok, *end;
+	struct can_filt_id *list, id;
+	struct can_filt_solution sol;
+	uint16_t nwant = 0, nothers = 0, *count;
+	unsigned lineno = 0;
+	int i;
+
+	if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+		fprintf(stderr, "Usage: %s [idlist]\n", argv[0]);
+		return 2;
+	}
+	if (argc == 2 && (in = fopen(argv[1], "r")) == NULL) {
+		perror(argv[1]);
+		return 2;
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		if ( (tok = strchr(line, '#')) != NULL )
+			*tok = '\0';
+		if ( (tok = strtok(line, " \t\r\n")) == NULL )
+			continue;
+
+		if (!strcmp(tok, "W") || !strcmp(tok, "w")) {
+			list = want;
+			count = &nwant;
+		} else if (!strcmp(tok, "O") || !strcmp(tok, "o")) {
+			list = others;
+			count = &nothers;
+		} else {
+			fprintf(stderr, "line %u: expected W or O\n", lineno);
+			return 2;
+		}
+
+		memset(&id, 0, sizeof(id));
+		id.rate = 1;
+		if ( (tok = strtok(NULL, " \t\r\n")) == NULL ) {
+			fprintf(stderr, "line %u: missing ID\n", lineno);
+			return 2;
+		}
+		id.id = strtoul(tok, &end, 0);
+		if (*end != '\0') {
+			fprintf(stderr, "line %u: bad ID '%s'\n", lineno, tok);
+			return 2;
+		}
+		while ( (tok = strtok(NULL, " \t\r\n")) != NULL ) {
+			if (!strcmp(tok, "x") || !strcmp(tok, "X"))
+				id.is_ext = 1;
+			else
+				id.rate = strtoul(tok, NULL, 0);
+		}
+		if (id.id > (id.is_ext ? 0x1FFFFFFFUL : 0x7FFUL)) {
+			fprintf(stderr, "line %u: ID 0x%lX out of range\n", lineno, (unsigned long)id.id);
+			return 2;
+		}
+		if (*count >= MAX_LINES) {
+			fprintf(stderr, "line %u: too many IDs\n", lineno);
+			return 2;
+		}
+		list[(*count)++] = id;
+	}
+
+	if (can_filt_solve(want, nwant, others, nothers, &sol) < 0) {
+		fprintf(stderr, "No wanted IDs, or more than %d of one format\n", CAN_FILTSOLVE_MAX_IDS);
+		return 1;
+	}
+
+	printf("\t/* %u wanted IDs, %u other IDs */\n", nwant, nothers);
+	for (i=0; i < 2; i++) {
+		printf("\tcan_rx_setmask(%d, 0x%08lX, %d);\n", i, (unsigned long)sol.mask[i], sol.is_ext[i]);
+		printf("\tcan_rx_setfilter(%d, 0, 0x%08lX);\n", i, (unsigned long)sol.filter[i ? 2 : 0]);
+		printf("\tcan_rx_setfilter(%d, 1, 0x%08lX);\n", i, (unsigned long)sol.filter[i ? 3 : 1]);
+		if (i) {
+			printf("\tcan_rx_setfilter(%d, 2, 0x%08lX);\n", i, (unsigned long)sol.filter[4]);
+			printf("\tcan_rx_setfilter(%d, 3, 0x%08lX);\n", i, (unsigned long)sol.filter[5]);
+		}
+	}
+	printf("\t/* Residual for a software filter: %lu unwanted IDs accepted", (unsigned long)sol.extra_ids);
+	if (nothers)
+		printf(", %lu frames/sec of listed traffic", (unsigned long)sol.extra_rate);
+	printf(" */\n");
+
+	return 0;
+}
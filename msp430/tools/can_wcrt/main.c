@@ -0,0 +1,298 @@
+/* can_wcrt - host tool
+ * Worst-case response-time analysis of a CAN message set, including the MCP2515's three
+ * non-abortable TX buffers and their TXP ordering on the node running this driver.
+ * 
+ * Input (a file or stdin), one message per line, # starts a comment:
+ *   M <id> <dlc> <period_ms> [x] [j=<jitter_ms>] [d=<deadline_ms>] [L[txp]]
+ * x marks an Extended ID, the deadline defaults to the period, and L marks a message sent
+ * by this node from the MCP2515, with the TXP priority (0-3, default 0) it is sent at.
+ *
+ * Copyright (c) 2020 Eric Brundick <spirilis [at] linux dot com>
+ *  Permission is hereby granted, free of charge, to any person 
+ *  obtaining a copy of this software and associated documentation 
+ *  files (the "Software"), to deal in the Software without 
+ *  restriction, including without limitation the rights to use, copy, 
+ *  modify, merge, publish, distribute, sublicense, and/or sell copies 
+ *  of the Software, and to permit persons to whom the Software is 
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be 
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ *  HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ *  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+ *  DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "can_framelen.h"
+
+#define MAX_MSGS 1024
+#define TX_BUFFERS 3
+
+struct msg {
+	uint32_t id;
+	uint8_t is_ext, dlc, local, txp;
+	uint32_t key;      // Arbitration order, lower wins
+	double t, j, d;    // Period, jitter, deadline (us)
+	double c;          // Worst-case transmission time (us)
+	uint16_t bits;
+	double r;          // Worst-case response time (us), < 0 if unbounded
+	int demoted;       // Index of the local frame it may be stuck behind, or -1
+};
+
+static struct msg msgs[MAX_MSGS];
+static unsigned nmsgs;
+static double tau;     // Bit time (us)
+
+/* Standard IDs win over Extended IDs with the same base ID (RTR vs. SRR), so the base ID comes first,
+ * then the IDE bit, then the ID extension.
+ */
+static uint32_t arb_key(uint32_t id, uint8_t is_ext)
+{
+	if (is_ext)
+		return ((id >> 18) << 19) | (1UL << 18) | (id & 0x3FFFF);
+	return id << 19;
+}
+
+// The bitrate can_speed(bitrate, ...) really configures: same prescaler search, whole TQ per bit
+static uint32_t can_speed_bitrate(uint32_t fosc, uint32_t bitrate)
+{
+	uint32_t brp = 0, a;
+
+	do {
+		brp++;
+		a = fosc / 2 / brp;
+		a /= bitrate;
+	} while (a > 25);
+	if (a < 8)
+		return 0;
+	return fosc / (2 * brp * a);
+}
+
+/* Response time of msgs[m] when it arbitrates at the priority of msgs[at] (itself unless it can be held
+ * behind a lower-priority local frame), after Davis, Burns, Bril & Lukkien, "Controller Area Network (CAN)
+ * schedulability analysis: Refuted, revisited and revised" (2007).  Returns < 0 if it exceeds the deadline.
+ */
+static double response(unsigned m, unsigned at)
+{
+	struct msg *mm = &msgs[m];
+	uint32_t key = msgs[at].key;
+	double b = 0, t, tn, w, wn, r, rmax = 0;
+	unsigned k, q, nq;
+
+	// Blocking: the longest frame of lower priority that may have just started
+	for (k=0; k < nmsgs; k++) {
+		if (msgs[k].key > key && k != m && msgs[k].c > b)
+			b = msgs[k].c;
+	}
+
+	// Level-m busy period, to know how many instances of m can be in it
+	t = mm->c;
+	for (;;) {
+		tn = b + ceil((t + mm->j) / mm->t) * mm->c;
+		for (k=0; k < nmsgs; k++) {
+			if (k != m && msgs[k].key <= key)
+				tn += ceil((t + msgs[k].j) / msgs[k].t) * msgs[k].c;
+		}
+		if (tn == t)
+			break;
+		if (tn > 1000 * (mm->d + mm->j))
+			return -1;  // Bus overloaded at this priority
+		t = tn;
+	}
+	nq = (unsigned)ceil((t + mm->j) / mm->t);
+
+	for (q=0; q < nq; q++) {
+		w = b + q * mm->c;
+		for (;;) {
+			wn = b + q * mm->c;
+			for (k=0; k < nmsgs; k++) {
+				if (k != m && msgs[k].key <= key)
+					wn += ceil((w + msgs[k].j + tau) / msgs[k].t) * msgs[k].c;
+			}
+			if (wn == w)
+				break;
+			w = wn;
+			if (mm->j + w - q * mm->t + mm->c > mm->d)
+				return -1;
+		}
+		r = mm->j + w - q * mm->t + mm->c;
+		if (r > rmax)
+			rmax = r;
+	}
+	return rmax > mm->d ? -1 : rmax;
+}
+
+/* A local message can end up behind lower-priority frames of the same node in two ways:
+ *  - all TX_BUFFERS buffers hold lower-priority frames, which can't be pulled back, so it has to wait
+ *    for one of them to go out before it is even loaded;
+ *  - a lower-priority frame sits in another buffer with a higher TXP, or an equal one (the MCP2515
+ *    then sends the highest-numbered buffer first), and is put up for arbitration ahead of it.
+ * Either way it is analysed as if it had the priority of the lowest-priority such frame.
+ */
+static int inversion(unsigned m)
+{
+	unsigned k, lower = 0;
+	int x = -1;
+
+	for (k=0; k < nmsgs; k++) {
+		if (msgs[k].local && msgs[k].key > msgs[m].key)
+			lower++;
+	}
+	for (k=0; k < nmsgs; k++) {
+		if ( !msgs[k].local || msgs[k].key <= msgs[m].key )
+			continue;
+		if (lower < TX_BUFFERS && msgs[k].txp < msgs[m].txp)
+			continue;
+		if (x < 0 || msgs[k].key > msgs[x].key)
+			x = k;
+	}
+	return x;
+}
+
+static int by_key(const void *a, const void *b)
+{
+	const struct msg *ma = a, *mb = b;
+
+	return (ma->key > mb->key) - (ma->key < mb->key);
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *in = stdin;
+	char line[256], *tok, *end;
+	struct msg *mm;
+	uint32_t fosc = 16000000, asked = 500000, bitrate;
+	double util = 0;
+	unsigned lineno = 0, i, bad = 0;
+	int opt;
+
+	for (opt=1; opt < argc && argv[opt][0] == '-' && argv[opt][1]; opt++) {
+		if (!strcmp(argv[opt], "-b") && opt+1 < argc)
+			asked = strtoul(argv[++opt], NULL, 0);
+		else if (!strcmp(argv[opt], "-f") && opt+1 < argc)
+			fosc = strtoul(argv[++opt], NULL, 0);
+		else
+			break;
+	}
+	if (opt < argc - 1 || (opt < argc && argv[opt][0] == '-')) {
+		fprintf(stderr, "Usage: %s [-b bitrate] [-f oscillator_hz] [msgset]\n", argv[0]);
+		return 2;
+	}
+	if (opt < argc && (in = fopen(argv[opt], "r")) == NULL) {
+		perror(argv[opt]);
+		return 2;
+	}
+
+	if (!asked || asked > 1000000 || !(bitrate = can_speed_bitrate(fosc, asked))) {
+		fprintf(stderr, "can_speed() can't produce %lu bps from a %lu Hz oscillator\n", (unsigned long)asked, (unsigned long)fosc);
+		return 2;
+	}
+	tau = 1e6 / bitrate;
+
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		if ( (tok = strchr(line, '#')) != NULL )
+			*tok = '\0';
+		if ( (tok = strtok(line, " \t\r\n")) == NULL )
+			continue;
+		if (strcmp(tok, "M") && strcmp(tok, "m")) {
+			fprintf(stderr, "line %u: expected M\n", lineno);
+			return 2;
+		}
+		if (nmsgs >= MAX_MSGS) {
+			fprintf(stderr, "line %u: too many messages\n", lineno);
+			return 2;
+		}
+		mm = &msgs[nmsgs];
+		memset(mm, 0, sizeof(*mm));
+
+		if ( (tok = strtok(NULL, " \t\r\n")) == NULL || (mm->id = strtoul(tok, &end, 0), *end) ) {
+			fprintf(stderr, "line %u: missing or bad ID\n", lineno);
+			return 2;
+		}
+		if ( (tok = strtok(NULL, " \t\r\n")) == NULL || (mm->dlc = strtoul(tok, &end, 0), *end) || mm->dlc > 8 ) {
+			fprintf(stderr, "line %u: missing or bad DLC\n", lineno);
+			return 2;
+		}
+		if ( (tok = strtok(NULL, " \t\r\n")) == NULL || (mm->t = strtod(tok, &end) * 1000, *end) || mm->t <= 0 ) {
+			fprintf(stderr, "line %u: missing or bad period\n", lineno);
+			return 2;
+		}
+		mm->d = -1;
+		while ( (tok = strtok(NULL, " \t\r\n")) != NULL ) {
+			if (!strcmp(tok, "x") || !strcmp(tok, "X")) {
+				mm->is_ext = 1;
+			} else if (!strncmp(tok, "j=", 2)) {
+				mm->j = strtod(tok+2, NULL) * 1000;
+			} else if (!strncmp(tok, "d=", 2)) {
+				mm->d = strtod(tok+2, NULL) * 1000;
+			} else if (tok[0] == 'L' || tok[0] == 'l') {
+				mm->local = 1;
+				mm->txp = tok[1] ? strtoul(tok+1, NULL, 0) & 0x03 : 0;
+			} else {
+				fprintf(stderr, "line %u: unknown option '%s'\n", lineno, tok);
+				return 2;
+			}
+		}
+		if (mm->id > (mm->is_ext ? 0x1FFFFFFFUL : 0x7FFUL)) {
+			fprintf(stderr, "line %u: ID 0x%lX out of range\n", lineno, (unsigned long)mm->id);
+			return 2;
+		}
+		if (mm->d <= 0)
+			mm->d = mm->t;
+		mm->key = arb_key(mm->id, mm->is_ext);
+		mm->bits = can_framelen_worst(mm->is_ext, 0, mm->dlc);
+		mm->c = mm->bits * tau;
+		util += mm->c / mm->t;
+		nmsgs++;
+	}
+
+	qsort(msgs, nmsgs, sizeof(msgs[0]), by_key);
+	for (i=0; i < nmsgs; i++) {
+		if (i && msgs[i].key == msgs[i-1].key) {
+			fprintf(stderr, "ID 0x%lX appears more than once\n", (unsigned long)msgs[i].id);
+			return 2;
+		}
+	}
+
+	for (i=0; i < nmsgs; i++) {
+		msgs[i].demoted = msgs[i].local ? inversion(i) : -1;
+		msgs[i].r = response(i, msgs[i].demoted < 0 ? i : (unsigned)msgs[i].demoted);
+		if (msgs[i].r < 0)
+			bad++;
+	}
+
+	printf("# can_speed(%lu) from %lu Hz: %lu bps, bit time %.3f us\n", (unsigned long)asked, (unsigned long)fosc,
+	       (unsigned long)bitrate, tau);
+	printf("# %u messages, bus utilization %.1f%% (worst-case stuffing)\n", nmsgs, util * 100);
+	printf("#         ID  DLC bits    C(ms)    T(ms)    J(ms)    D(ms)    R(ms)  notes\n");
+	for (i=0; i < nmsgs; i++) {
+		mm = &msgs[i];
+		printf("%c %*s%0*lX  %3u %4u %8.3f %8.3f %8.3f %8.3f ", mm->local ? 'L' : ' ',
+		       mm->is_ext ? 1 : 6, "", mm->is_ext ? 8 : 3, (unsigned long)mm->id,
+		       mm->dlc, mm->bits, mm->c / 1000, mm->t / 1000, mm->j / 1000, mm->d / 1000);
+		if (mm->r < 0)
+			printf("%8s  UNSCHEDULABLE", "-");
+		else
+			printf("%8.3f ", mm->r / 1000);
+		if (mm->demoted >= 0)
+			printf(" inversion behind 0x%lX", (unsigned long)msgs[mm->demoted].id);
+		printf("\n");
+	}
+
+	if (util > 1)
+		printf("# Bus overloaded\n");
+	if (bad)
+		printf("# %u message(s) can miss their deadline\n", bad);
+	return bad ? 1 : 0;
+}